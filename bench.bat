@@ -0,0 +1,16 @@
+setlocal enabledelayedexpansion
+del c.exe eu.exe vc cc cc50k.c bench.x
+gcc -o c -O3 -m32 -Imingw -Iroot/lib root/bin/c.c
+gcc -o eu -O3 -m32 -Imingw -Iroot/lib root/bin/eu.c
+c -o vc -Iroot/lib root/bin/c.c
+c -o cc -Iroot/lib root/usr/bench/cc.c
+eu cc -g 50000 cc50k.c
+for %%f in (root\bin\c.c root\etc\os.c root\usr\demo\calc.c root\bin\vt.c cc50k.c) do (
+  echo %%f: host, emulated
+  echo !time!
+  c -Iroot/lib -o bench.x %%f
+  echo !time!
+  eu vc -Iroot/lib -o bench.x %%f
+  echo !time!
+)
+del bench.x
@@ -0,0 +1,15 @@
+#!/bin/sh
+rm -f xc xeu c xcx cc cc50k.c bench.x
+gcc -o xc -O3 -Ilinux -Iroot/lib root/bin/c.c
+gcc -o xeu -O3 -m32 -Ilinux -Iroot/lib root/bin/eu.c -lm
+./xc -o c -Iroot/lib root/bin/c.c
+./xc -x -o xcx -Iroot/lib root/bin/c.c
+./xc -o cc -Iroot/lib root/usr/bench/cc.c
+./xeu cc -g 50000 cc50k.c
+for f in root/bin/c.c root/etc/os.c root/usr/demo/calc.c root/bin/vt.c cc50k.c; do
+  echo "$f: host, native, emulated"
+  time ./xc -Iroot/lib -o bench.x $f
+  time ./xcx -Iroot/lib -o bench.x $f
+  time ./xeu c -Iroot/lib -o bench.x $f
+done
+rm -f bench.x
@@ -1,4 +1,5 @@
 del c.exe em.exe eu.exe mkfs.exe gld.exe fsd.exe term.exe c em eu
 del hello.exe hello emhello euhello hello.txt emhello.txt euhello.txt c em eu
 del os0 os1 os2 os3
+del vc cc cc50k.c bench.x
 del fs.img root\bin\c root\etc\os root\etc\sfs.img
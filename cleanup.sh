@@ -2,4 +2,5 @@
 rm -f xc xem xeu xmkfs gld fsd term
 rm -f xhello hello emhello euhello hello.txt emhello.txt euhello.txt c em eu
 rm -f os0 os1 os2 os3
+rm -f xcx cc cc50k.c bench.x
 rm -f fs.img root/bin/c root/etc/os root/etc/sfs.img
@@ -11,6 +11,7 @@
 #include <stdarg.h>
 #include <termios.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
 
 #define NOFILE 16 // XXX subject to change
@@ -93,6 +94,24 @@ int xlseek(int d, int offset, int whence)
 {
   return ((uint)d >= NOFILE) ? -1 : lseek(xfd[d], offset, whence);
 }
+int xsendfile(int out, int in, int n)
+{
+  static char b[4096]; int r, m, t;
+  for (r = t = 0; t < n; t += r) {
+    if ((m = n - t) > sizeof(b)) m = sizeof(b);
+    if ((r = xread(in, b, m)) <= 0 || xwrite(out, b, r) != r) break;
+  }
+  return t ? t : r;
+}
+void *xmmap(void *a, int n, int prot, int flags, int d, int off) // zero fill past the end of the file rather than fault
+{
+  char *p; struct stat hs; int m;
+  if ((p = mmap(a, n, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED || (flags & MAP_ANONYMOUS)) return p;
+  if ((uint)d >= NOFILE || xft[d] != xFILE || fstat(xfd[d], &hs)) { munmap(p, n); return MAP_FAILED; }
+  if ((m = hs.st_size - off) > n) m = n;
+  if (m > 0 && mmap(p, m, prot, flags | MAP_FIXED, xfd[d], off) == MAP_FAILED) { munmap(p, n); return MAP_FAILED; }
+  return p;
+}
 int xprintf(char *f, ...)
 {
   static char buf[4096]; va_list v; int n;
@@ -126,6 +145,7 @@ struct xstat {
   uint   st_ino;   // inode number on device
   uint   st_nlink; // number of links to file
   uint   st_size;  // size of file in bytes
+  uint   st_gen;   // file generation (modification time here)
 };
 int xfstat(int d, struct xstat *s)
 {
@@ -137,6 +157,7 @@ int xfstat(int d, struct xstat *s)
     s->st_ino   = 0;
     s->st_nlink = 0;
     s->st_size  = 0;
+    s->st_gen   = 0;
     r = 0;
   } else if (!(r = fstat(xfd[d], &hs))) {
     s->st_mode  = S_IFREG;
@@ -144,6 +165,7 @@ int xfstat(int d, struct xstat *s)
     s->st_ino   = hs.st_ino;
     s->st_nlink = hs.st_nlink;
     s->st_size  = hs.st_size;
+    s->st_gen   = hs.st_mtime;
   }
   return r;
 }
@@ -156,6 +178,7 @@ int xstat(char *file, struct xstat *s)
     s->st_ino   = hs.st_ino;
     s->st_nlink = hs.st_nlink;
     s->st_size  = hs.st_size;
+    s->st_gen   = hs.st_mtime;
   }
   return r;
 }
@@ -216,6 +239,8 @@ int main(int argc, char *argv[])
 #define read     xread
 #define write    xwrite
 #define lseek    xlseek
+#define sendfile xsendfile
+#define mmap     xmmap
 #define stat     xstat
 #define fstat    xfstat
 #define mkdir    xmkdir
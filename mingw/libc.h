@@ -18,6 +18,7 @@
 #define PATH_MAX 256
 
 enum { xCLOSED, xCONSOLE, xFILE, xSOCKET, xDIR };
+enum { PROT_READ = 1, PROT_WRITE = 2, MAP_SHARED = 1, MAP_PRIVATE = 2, MAP_ANON = 0x20 };
 int xfd[NOFILE];
 int xft[NOFILE];
 int (*pxswrite)(int, void *, int);
@@ -157,6 +158,23 @@ int xlseek(int d, int offset, int whence)
 {
   return ((uint)d >= NOFILE) ? -1 : lseek(xfd[d], offset, whence);
 }
+int xsendfile(int out, int in, int n)
+{
+  static char b[4096]; int r, m, t;
+  for (r = t = 0; t < n; t += r) {
+    if ((m = n - t) > sizeof(b)) m = sizeof(b);
+    if ((r = xread(in, b, m)) <= 0 || xwrite(out, b, r) != r) break;
+  }
+  return t ? t : r;
+}
+void *xmmap(void *a, int n, int prot, int flags, int d, int off) // XXX private copy, shared mappings are not written back
+{
+  char *p;
+  if (!(p = calloc(1, n))) return (void *)-1;
+  if (!(flags & MAP_ANON) && (xlseek(d, off, SEEK_SET) < 0 || xread(d, p, n) < 0)) { free(p); return (void *)-1; }
+  return p;
+}
+int xmunmap(void *p, int n) { free(p); return 0; }
 int xprintf(char *f, ...)
 {
   static char buf[4096]; va_list v; int n;
@@ -190,6 +208,7 @@ struct xstat {
   uint   st_ino;   // inode number on device
   uint   st_nlink; // number of links to file
   uint   st_size;  // size of file in bytes
+  uint   st_gen;   // file generation (modification time here)
 };
 int xfstat(int d, struct xstat *s)
 {
@@ -201,6 +220,7 @@ int xfstat(int d, struct xstat *s)
     s->st_ino   = 0;
     s->st_nlink = 0;
     s->st_size  = 0;
+    s->st_gen   = 0;
     r = 0;
   } else if (!(r = fstat(xfd[d], &hs))) {
     s->st_mode  = S_IFREG;
@@ -208,6 +228,7 @@ int xfstat(int d, struct xstat *s)
     s->st_ino   = hs.st_ino;
     s->st_nlink = hs.st_nlink;
     s->st_size  = hs.st_size;
+    s->st_gen   = hs.st_mtime;
   }
   return r;
 }
@@ -220,6 +241,7 @@ int xstat(char *file, struct xstat *s)
     s->st_ino   = hs.st_ino;
     s->st_nlink = hs.st_nlink;
     s->st_size  = hs.st_size;
+    s->st_gen   = hs.st_mtime;
   }
   return r;
 }
@@ -263,6 +285,9 @@ int main(int argc, char *argv[])
 #define read     xread
 #define write    xwrite
 #define lseek    xlseek
+#define sendfile xsendfile
+#define mmap     xmmap
+#define munmap   xmunmap
 #define stat     xstat
 #define fstat    xfstat
 #define main     xmain
@@ -1,19 +1,58 @@
 // c -- c compiler
 //
-// Usage:  c [-v] [-s] [-Ipath] [-o exefile] file ...
+// Usage:  c [-v] [-s] [-c] [-x] [-O[size]] [-Ipath] [-Cpath] [-Pprofile] [-o exefile] file ...
 //
 // Description:
 //   c is the c compiler.  It takes a single source file and creates an executable
 //   file or else executes the compiled code immediately.  The compiler does not
 //   reach full standards compliance, so some programs need minor adjustment.
 //   There is no preprocessor, although the #include keyword is allowed
-//   supporting a single level of file inclusion.
+//   supporting a single level of file inclusion.  Since libraries are headers,
+//   functions that main can not reach through calls or taken addresses are dropped
+//   from the output.  A source file over 1M is read through a window that moves
+//   on between top level declarations, so each one must fit in half of it.  Labels
+//   have addresses, as in gcc: &&label is a void * that goto * jumps to.  A
+//   program that includes libc.h starts at its xstart(), which exits with what
+//   main returns so buffered output is flushed.
 //
 //   The following options are supported:
 //
 //   -v  Verbose output.  Useful for finding undeclared function calls.
 //   -s  Print source and generated code.
+//   -c  Create a relocatable object file (file.o unless -o) for ld(1) instead of an
+//       executable.  main() is optional and functions called but not defined are left
+//       for ld to find in another object.  Function bodies in an include file x.h are
+//       skipped if an object x.o sits next to it, and ld links that in instead, so
+//       library objects are built once by compiling a file that includes the header
+//       into that object,
+//           c -c -o /lib/libc.o /lib/libc.c
+//       Bodies of nothing but asm() statements are still compiled for calls to
+//       expand.  Implies no -C.
+//   -x  Create a native x86-64 linux executable rather than one for the emulator, by
+//       translating the generated code.  Lets the host tools (the compiler itself,
+//       mkfs) be built without gcc,
+//           c -x -o xc -Iroot/lib root/bin/c.c
+//       System calls go to linux, except exec() and the network calls.  Needs -o.
+//   -O  Expand calls to small functions in place by replaying their source.  Functions
+//       with no locals, labels, macros or asm and at most size instructions (default 16)
+//       qualify.  Arrays indexed by the counter of a for loop are walked with hidden
+//       pointers stepped alongside it.  A call in return position jumps rather than
+//       returns, reusing the frame, when the function has no arrays or structs and no
+//       local whose address is taken.  Also cleans up the generated code with a
+//       peephole pass (-O0 does only that.)
 //   -I  Path to include files (otherwise source directory or /lib/.)
+//   -C  Path to a compiled binary cache.  When running the compiled code, a binary
+//       built from the same source and include files (matched by inode, generation
+//       and size) with the same -O and -P options is executed from the cache instead
+//       of compiling again.  Otherwise
+//       the new binary is saved there.  exec() runs source files this way.
+//       The compiler state after the leading #include lines of a source file is
+//       also kept there as a precompiled header and restored by later compiles
+//       starting with the same lines and options.
+//   -P  Lay out each function's code by a profile written by eu -p from a run of the
+//       same program built the same way without -P.  The more often taken way out of
+//       each conditional branch falls through, and code the run never reached moves to
+//       the end of the function.
 //   -o  Create executable file and terminate normally.  If -o and -s are omitted,
 //       the compiled code is executed immediately (if there were no compile
 //       errors) with the command line arguments passed after the source file
@@ -32,15 +71,34 @@
 
 enum {
   SEG_SZ    = 8*1024*1024, // max size of text+data+bss seg
-  EXPR_SZ   =      4*1024, // size of expression stack
-  VAR_SZ    =    256*1024, // size of symbol table
-  PSTACK_SZ =     64*1024, // size of patch stacks
-  LSTACK_SZ =      4*1024, // size of locals stack
-  HASH_SZ   =      8*1024, // number of hash table entries
+  EXPR_SZ   =    256*1024, // size of expression stack (also holds switch case lists)
+  VAR_SZ    = 4*1024*1024, // size of symbol table (types hold offsets into it in 22 bits)
+  PSTACK_SZ =   1024*1024, // size of patch stacks
+  LSTACK_SZ =     64*1024, // size of locals stack
+  HASH_SZ   =      4*1024, // initial number of hash table entries, doubled as identifiers are added
+  STK_SZ    = EXPR_SZ + PSTACK_SZ * 4 + LSTACK_SZ,
+  WIN_SZ    =   1024*1024, // source window, larger input files are read a piece at a time
   MSTACK_SZ =          16, // number of #define macro recursion levels
+  DEP_SZ    =          32, // number of source files recorded for the binary cache
+  STUB_SZ   =           8, // max instructions in an asm() stub expanded at call sites
+  INLINE_SZ =          16, // default -O budget: max instructions in a function expanded at call sites
+  INLINE_NP =           8, // max parameters of such a function
+  IV_SZ     =           8, // max nested for loops walking arrays with hidden pointers
+  IV_NP     =           4, // max hidden pointers per loop
+  IV_NW     =          16, // max locals a loop can write and still have invariant pointer bases
+  IV_NB     =           8, // max bracket nesting looked at in a loop
   BSS_TAG   =  0x10000000, // tag for patching global offsets
+  PCH_MAGIC =  0xC0DEF11F, // precompiled header file magic
+  OBJ_MAGIC =  0xC0DE0B1E, // relocatable object file magic
+  PRF_MAGIC =  0xC0DEB4AC, // branch profile file magic (eu -p)
+  X_BASE    =    0x400000, // native executable load address
+  X_HDR     =         128, // native executable header size
+  X_STACK   = 8*1024*1024, // native stack size
+  X_ARGS    =    256*1024, // native command line space
 };
 
+enum { OBJ_FUN = 1, OBJ_EXT, OBJ_GLO, OBJ_NEED, OBJ_WEAK = 8 }; // object symbol kinds: function, function import, global, companion object
+
 typedef struct ident_s {
   uint class;
   uint type;
@@ -51,6 +109,9 @@ typedef struct ident_s {
   char *macro;
   int hash;
   struct ident_s *next;
+  int stub; // asm() stub body (count then instructions) offset in va
+  int inl;  // inline_t offset in va
+  int lib;  // defined in an include file
 } ident_t;
 
 typedef struct {
@@ -81,6 +142,47 @@ typedef struct {
   int size;
 } array_t;
 
+typedef struct { // function body that -O can replay at call sites
+  char *body;       // source after the opening brace
+  uint rt;          // return type
+  int size;         // instructions
+  int busy;         // being expanded (no recursion)
+  int np;           // parameters
+  int pid[INLINE_NP];  // their identifier offsets in va
+  uint ptype[INLINE_NP];
+  int pval[INLINE_NP]; // and offsets in the callee frame
+} inline_t;
+
+typedef struct { // for loop whose induction variable indexes arrays, walked by hidden pointers under -O
+  int v;            // frame offset of the variable
+  int step;         // added to it each iteration
+  int slot;         // frame offset of the first hidden pointer
+  int n, max;       // hidden pointers used and reserved
+  int nw;           // locals written in the loop, -1 if too many to list
+  int w[IV_NW];
+  int kind[IV_NP];  // each pointer walks a Lea, Leag or Auto base
+  int base[IV_NP];
+  int scale[IV_NP]; // times the variable
+} iv_t;
+
+typedef struct { // precompiled header file layout
+  uint magic;
+  int key, ndep, nhdr, pool, text, data, bss, npdata, npbss, npfun, npbody, ffun, hmask;
+  long va, ts;
+} pch_t;
+
+typedef struct { // relocatable object file layout (same in ld.c)
+  uint magic;
+  int text, data, bss, npdata, npbss, npfun, npbody, nsym, nstr;
+} obj_t;
+
+typedef struct { // object file symbol
+  int name;   // string table offset
+  int kind;   // OBJ_ kind, with OBJ_WEAK if from an include file
+  int val;    // function body start, global data offset (bss ones tagged), or 0
+  int size;   // global size
+} sym_t;
+
 typedef union node_u {
   int i;
   uint u;
@@ -97,9 +199,17 @@ int tk,       // current token
     errs,     // number of errors
     verbose,  // print additional verbiage
     debug,    // print source and object code
+    optimize, // instruction budget for expanding functions in place
+    peephole, // run peep() over the finished text
+    native,   // write a native x86-64 executable
+    opaque,   // macro expansions and asm statements, which replaying a body can't repeat
+    iret,     // return patchup list while expanding a function in place
     ffun,     // unresolved forward function counter
+    lib,      // in an include file (2 if its function bodies are left to a companion object)
     *pdata,   // data segment patchup pointer
-    *pbss;    // bss segment patchup pointer
+    *pbss,    // bss segment patchup pointer
+    *pfun,    // function reference (call or address) list pointer
+    *pbody;   // function body start and end offset list pointer
 
 long ts,      // text segment
     gs,       // data segment
@@ -116,9 +226,47 @@ uint ty,      // current parsed subexpression type
 char *file,   // input file name
      *cmd,    // command name
      *incl,   // include path
+     *cache,  // compiled binary cache path
+     *object, // relocatable object file being compiled for ld
+     *profile, // branch profile to lay out the text by
      *pos;    // input file position
 
-loc_t *ploc;  // local variable stack pointer
+int ndep;                 // number of source files read
+char *dname[DEP_SZ];      // their names
+struct stat dstat[DEP_SZ]; // and their state when read
+char okey[PATH_MAX + 32]; // the options the code depends on (-O, its size, -P), part of every cache key
+
+int nneed;                // number of companion objects whose function bodies were skipped
+char *need[DEP_SZ];       // their names
+ident_t **defs, **pdef;   // identifiers given a global class, for its symbols
+
+char *xs;                 // native code
+int xp, xrt, xtab, xd,    // its offset, the runtime offset, and the switch table and data addresses
+    *xmap;                // native offset of each instruction
+
+int nhdr;                 // number of header text regions (keywords and include files)
+char *hbase[DEP_SZ];      // their text
+int hsize[DEP_SZ];        // and size
+
+char *win, *wend;         // source window of a large input file, and the zero after the whole lines in it
+int wfd = -1, wlen;       // the file while more of it remains, and the bytes read into the window
+char wc;                  // the character under the zero
+
+ident_t **ht;             // identifier hash table
+int hmask, nid;           // its size - 1, and the identifiers in it
+char cid[256];            // 1 for characters that can continue an identifier
+struct_t *structs;        // struct and union list
+
+loc_t *ploc,  // local variable stack pointer
+      *pframe; // and where the current function's entries start
+
+iv_t ivs[IV_SZ]; // enclosing for loops with an induction variable, innermost last
+int niv,         // their number
+    ivaddr,      // current function scanned for locals whose address is taken (2 if it uses va_start)
+    fargs,       // parameter slots of the current function
+    ntail,       // calls in return position made into jumps
+    fline;       // line of the current function body
+char *fbody;     // and its source
 
 char ops[] =
   "HALT,ENT ,LEV ,JMP ,JMPI,JSR ,JSRA,LEA ,LEAG,CYC ,MCPY,MCMP,MCHR,MSET," // system
@@ -193,27 +341,110 @@ void *new(int size)
   return (void *)(((long)p + 7) & -8);
 }
 
+// reserve an arena, paged in as it is touched if the system can map zero filled memory
+void *arena(int size)
+{
+  void *p;
+  if ((p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == (void *)-1) return new(size);
+  return p;
+}
+
 void err(char *msg)
 {
   dprintf(2,"%s : [%s:%d] error: %s\n", cmd, file, line, msg); // XXX need errs to power past tokens (validate for each err case.)
   if (++errs > 10) { dprintf(2,"%s : fatal: maximum errors exceeded\n", cmd); exit(-1); }
 }
 
-char *mapfile(char *name, int size) // XXX replace with mmap
+// record a file the binary is built from
+void dep(char *name, int f)
+{
+  if (ndep == DEP_SZ) { cache = 0; return; }
+  if (f >= 0 ? fstat(f, &dstat[ndep]) : stat(name, &dstat[ndep])) return;
+  dname[ndep++] = strcpy(new(strlen(name) + 1), name);
+}
+
+// cache entry name for the input file plus ext
+char *cachename(char *s, char *ext)
+{
+  char *p, *f;
+  uint h;
+  p = s + sprintf(s, "%s/", cache);
+  for (f = file; *f && p < s + PATH_MAX - 18; f++) *p++ = (*f == '/') ? '_' : *f;
+  if (strcmp(okey, "0 0 ")) { for (h = 0, f = okey; *f; f++) h = h * 147 + *f; p += sprintf(p, ".%08x", h); } // not the plain build
+  strcpy(p, ext);
+  return s;
+}
+
+// run the cached binary if it was built from the same files as are there now
+void cached(char **argv)
+{
+  int f, i; char *p, *e, name[PATH_MAX]; struct stat st, ds;
+  if ((f = open(cachename(name, ".d"), O_RDONLY)) < 0) return;
+  if (fstat(f, &st) || read(f, p = new(st.st_size + 1), st.st_size) != st.st_size) { close(f); return; }
+  close(f);
+  e = p + st.st_size; *e = 0;
+  if (strcmp(p, okey)) return; // built with other options
+  for (p += strlen(p) + 1, i = 0; p < e; p += strlen(p) + 1, i++) {
+    memcpy(&ds, p, sizeof(ds));
+    p += sizeof(ds);
+    if (!i && strcmp(p, file)) return; // another file with the same cache name
+    if (stat(p, &st) || st.st_ino != ds.st_ino || st.st_gen != ds.st_gen || st.st_size != ds.st_size) return;
+  }
+  if (verbose) dprintf(2,"%s : running cached %s\n", cmd, file);
+  exec(cachename(name, ".x"), argv);
+}
+
+char *mapfile(char *name, int size)
 {
   int f; char *p;
   if ((f = open(name, O_RDONLY)) < 0) { dprintf(2,"%s : [%s:%d] error: can't open file %s\n", cmd, file, line, name); exit(-1); }
-  p = new(size+1);
-  if (read(f, p, size) != size) { dprintf(2,"%s : [%s:%d] error: can't read file %s\n", cmd, file, line, name); exit(-1); }
+  dep(name, f);
+  p = mmap(0, size+1, PROT_READ, MAP_PRIVATE, f, 0); // the byte past the end reads as zero
+  if (p == (char *)-1) { dprintf(2,"%s : [%s:%d] error: can't map file %s\n", cmd, file, line, name); exit(-1); }
   close(f);
-  p[size] = 0; // XXX redundant but need to map file!
   return p;
 }
 
+// move the unread text at p to the front of the window and fill the rest from the file
+void slide(char *p)
+{
+  int n;
+  *wend = wc;
+  memcpy(win, p, wlen -= p - win); // less than half the window is left, so it doesn't overlap
+  while (wlen < WIN_SZ && (n = read(wfd, win + wlen, WIN_SZ - wlen)) > 0) wlen += n;
+  if (wlen < WIN_SZ) { close(wfd); wfd = -1; wend = win + wlen; } // the rest of the file
+  else {
+    for (wend = win + wlen; wend > win && wend[-1] != '\n'; wend--) ;
+    if (wend == win) { err("line too long for the source window"); exit(-1); }
+  }
+  wc = *wend; *wend = 0;
+}
+
+// read a large input file through the window
+char *openwin(char *name)
+{
+  if ((wfd = open(name, O_RDONLY)) < 0) { dprintf(2,"%s : [%s:%d] error: can't open file %s\n", cmd, file, line, name); exit(-1); }
+  dep(name, wfd);
+  wend = win = arena(WIN_SZ + 1);
+  slide(win);
+  return win;
+}
+
+// copy n bytes at p to the pool if they are in the source window, which moves on
+char *keep(char *p, int n)
+{
+  char *s;
+  if (!win || p < win || p > win + WIN_SZ) return p;
+  if (vp + n + 1 > va + VAR_SZ) { err("symbol table overflow"); exit(-1); }
+  s = memcpy((char *)vp, p, n); s[n] = 0;
+  vp = (vp + n + 8) & -8;
+  return s;
+}
+
 // instruction emitter
 void em(int i)
 {
-  if (debug) printf("%08x  %08x%6.4s\n", ip, i, &ops[i*5]);
+  if (debug) printf("%08x  %08x%6.4s\n", ip, i, &ops[(i & 0xff)*5]);
   *(int *)(ts+ip) = i;
   ip += 4;
 }
@@ -254,13 +485,41 @@ void dline(void)
   printf("%s  %d: %.*s\n", file, line, p - pos, pos);
 }
 
+// resize the identifier hash table to mask + 1 entries
+void rehash(int mask)
+{
+  int i; ident_t **t, *v, *n;
+
+  t = memset(new((mask + 1) * sizeof(ident_t *)), 0, (mask + 1) * sizeof(ident_t *));
+  if (ht) {
+    for (i = 0; i <= hmask; i++) {
+      for (v = ht[i]; v; v = n) { n = v->next; v->next = t[v->hash & mask]; t[v->hash & mask] = v; }
+    }
+  }
+  ht = t;
+  hmask = mask;
+}
+
+// is header h the companion of source s, x.h beside x.c, however either path is spelt
+int companion(char *h, char *s)
+{
+  char d[512]; int i, j, n; struct stat hs, ss;
+
+  for (i = strlen(h); i && h[i-1] != '/'; i--) ;
+  for (j = strlen(s); j && s[j-1] != '/'; j--) ;
+  if ((n = strlen(s + j)) < 3 || n != strlen(h + i) || memcmp(h + i, s + j, n - 1) || memcmp(s + j + n - 2, ".c", 2) || i > sizeof(d) - 1 || j > sizeof(d) - 1) return 0;
+  if (i) { memcpy(d, h, i); d[i > 1 ? i - 1 : i] = 0; } else strcpy(d, ".");
+  if (stat(d, &hs)) return 0;
+  if (j) { memcpy(d, s, j); d[j > 1 ? j - 1 : j] = 0; } else strcpy(d, ".");
+  return !stat(d, &ss) && hs.st_ino == ss.st_ino && hs.st_dev == ss.st_dev;
+}
+
 void next(void)
 {
   char *p; int b, ex; ident_t **hm;
   struct stat st;
-  static char iname[512], *ifile, *ipos; // XXX 512
+  static char iname[512], cname[512], *ifile, *ipos; // XXX 512
   static int iline;
-  static ident_t *ht[HASH_SZ];
   static char *mstack[MSTACK_SZ];
   static int mlevel;
 
@@ -306,6 +565,13 @@ again:
         }
         while (*pos && *pos != '\n') pos++;
         ipos = pos; pos = mapfile(iname, st.st_size);
+        if (nhdr < DEP_SZ) { hbase[nhdr] = pos; hsize[nhdr++] = st.st_size; }
+        lib = 1;
+        if (object && (b = strlen(iname)) > 2 && !strcmp(iname + b - 2, ".h")) { // x.h has its bodies in x.o?
+          memcpy(cname, iname, b + 1); cname[b-1] = 'o';
+          if (companion(iname, file)) lib = 0; // building x.o from x.c, keep every body
+          else if (!stat(cname, &st) && nneed < DEP_SZ) { lib = 2; need[nneed++] = strcpy(new(b + 1), cname); }
+        }
         ifile = file; file = iname;
         iline = line; line = 1;
         if (debug) dline();
@@ -316,7 +582,8 @@ again:
         next();
         if (tk != Id) { err("bad define"); exit(-1); }
         mlevel = 0;
-        id->macro = pos;
+        for (p = pos; *p && *p != '\n'; p++) ;
+        id->macro = keep(pos, p - pos + (*p == '\n')); // with the newline that ends an expansion
       } else if (!memcmp(pos,"undef",5)) {
         pos += 5;
         mlevel = -1;
@@ -338,12 +605,13 @@ again:
         }
         break;
       }
-      id = *(hm = &ht[tk & (HASH_SZ - 1)]);
-      tk ^= (b = pos - p);
+      tk += (b = pos - p) << 29; // exact for b < 5
+      id = *(hm = &ht[tk & hmask]);
       while (id) {
-        if (tk == id->hash && (b < 5 || !memcmp(id->name, p, b))) { // b < 5 dependant on hash func and size
+        if (tk == id->hash && (b < 5 || (!memcmp(id->name, p, b) && !cid[(uchar)id->name[b]]))) {
           if (id->macro && mlevel != -1) {
             if (mlevel == MSTACK_SZ) { err("exceeded macro recursion level"); exit(-1); }
+            opaque++;
             mstack[mlevel++] = pos;
             pos = id->macro;
             goto again;
@@ -353,12 +621,14 @@ again:
         }
         id = id->next;
       }
+      if (vp + sizeof(ident_t) > va + VAR_SZ) { err("symbol table overflow"); exit(-1); }
       id = (ident_t *) vp; vp += sizeof(ident_t);
-      id->name = p;
+      id->name = keep(p, b);
       id->hash = tk;
       id->next = *hm;
       tk = id->tk = Id;
       *hm = id;
+      if (++nid > hmask) rehash(hmask * 2 + 1);
       return;
 
     case '0' ... '9':
@@ -505,8 +775,11 @@ frac:     b = 10;
     case ')':
     case ']': return;
     case 0:
-      if (!ifile) { pos--; return; }
-      file = ifile; ifile = 0;
+      if (!ifile) {
+        if (pos - 1 == wend && wfd >= 0) { err("declaration too long for the source window"); exit(-1); }
+        pos--; return;
+      }
+      file = ifile; ifile = 0; lib = 0;
       pos = ipos;
       line = iline;
       continue;
@@ -522,9 +795,50 @@ void skip(int c)
   next();
 }
 
+// whether the function body after its opening brace at p is asm() statements alone, which calls expand in place
+int asmonly(char *p)
+{
+  for (;;) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p == '}') return 1;
+    if (memcmp(p, "asm(", 4)) return 0;
+    while (*p && *p != ')' && *p != '\n') p++;
+    if (*p++ != ')') return 0;
+    while (*p == ' ') p++;
+    if (*p++ != ';') return 0;
+  }
+}
+
+// pass over a function body after its opening brace without compiling it
+void skipbody(void)
+{
+  int d, c;
+  for (d = 1; d && *pos; ) {
+    switch (c = *pos++) {
+    case '\n': line++; continue;
+    case '{': d++; continue;
+    case '}': d--; continue;
+    case '"':
+    case '\'':
+      while (*pos && *pos != c) { if (*pos == '\\' && pos[1]) pos++; if (*pos == '\n') line++; pos++; }
+      if (*pos) pos++;
+      continue;
+    case '/':
+      if (*pos == '/') while (*pos && *pos != '\n') pos++;
+      else if (*pos == '*') {
+        for (pos++; *pos && (*pos != '*' || pos[1] != '/'); pos++) if (*pos == '\n') line++;
+        if (*pos) pos += 2;
+      }
+    }
+  }
+  next();
+}
+
 void expr(int lev);
 void member(int stype, struct_t *s);
 void rv(N a);
+void stubdef(ident_t *v);
+void inlinedef(ident_t *v, char *body, loc_t *sp);
 void stmt(void);
 void node(int n, N a, N b);
 void cast(uint t);
@@ -597,7 +911,6 @@ int talign(uint t)
 uint basetype(void)
 {
   int m; ident_t *n; struct_t *s;
-  static struct_t *structs;
 
   switch (tk) {
   case Void:    next(); return VOID; // XXX
@@ -761,9 +1074,10 @@ uint *type(uint *t, ident_t **v, uint bt)
 
 void decl(int bc)
 {
-  int sc, size, align, hglo; uint bt, t; ident_t *v; loc_t *sp; N b, c=0;
+  int sc, size, align, hglo, op; uint bt, t; ident_t *v; loc_t *sp, *pp; N b, c=0; char *bp, *ep;
 
   for (;;) {
+    if (bc == Static && wfd >= 0 && pos >= win && pos <= wend && win + wlen - pos < WIN_SZ / 2) { slide(pos); pos = win; } // nothing points into the window between declarations
     if (tk == Static || tk == Typedef || (tk == Auto && bc == Auto))
       { sc = tk; next(); if (!(bt = basetype())) bt = INT; } // XXX typedef inside function?  probably bad!
     else { if (!(bt = basetype())) { if (bc == Auto) break; bt = INT; } sc = bc; }
@@ -774,7 +1088,7 @@ void decl(int bc)
       sp = ploc;
       type(&t, &v, bt);
       if (!v) err("bad declaration");
-      else if (tk == '{') {
+      else if (tk == '{' && (lib != 2 || asmonly(pos))) {
         if (bc != Static || sc != Static) err("bad nested function");
         if ((t & TMASK) != FUN) err("bad function definition");
         rt = *(uint *)(va+(t>>TSHIFT));
@@ -784,10 +1098,16 @@ void decl(int bc)
             bt != *(uint *)(va+(t>>TSHIFT)+4))) err("conflicting forward function declaration");
         }
         else if (v->class) err("duplicate function definition");
+        else if (object) *pdef++ = v;
         v->class = Fun;
         v->type = t;
         v->val = ts+ip;
+        v->lib = lib;
+        for (fargs = 0, bt = *(uint *)(va+(t>>TSHIFT)+4); bt; bt >>= 2) fargs++;
+        *pbody++ = ip;
         loc = 0;
+        pframe = sp;
+        bp = fbody = pos; fline = line; ivaddr = 0; pp = ploc; op = opaque;
         next();
         b = e;
         decl(Auto);
@@ -795,8 +1115,12 @@ void decl(int bc)
         if (loc) emi(ENT,loc);
         if (e != b) { rv(e); e = b; }
         while (tk != '}') stmt(); // XXX null check
+        ep = pos;
         next();
         emi(LEV,-loc);
+        *pbody++ = ip;
+        if (!loc) stubdef(v);
+        if (!loc && ploc == pp && opaque == op) inlinedef(v, keep(bp, ep - bp), sp); // no locals, labels, macros or asm
         while (ploc != sp) {
           ploc--;
           v = ploc->id;
@@ -809,10 +1133,14 @@ void decl(int bc)
         break;
       } else if ((t & TMASK) == FUN) {
 //        if (bc != Static || sc != Static) err("bad nested function declaration");
-        if (v->class && v->class != FFun) err("duplicate function declaration");
-        v->class = FFun;
-        v->type = t;
-        ffun++;
+        if (v->class == Fun) ; // declared again after its body, as main is by libc.h
+        else if (v->class && v->class != FFun) err("duplicate function declaration");
+        else {
+          if (object && !v->class) *pdef++ = v;
+          if (!v->class) ffun++;
+          v->class = FFun;
+          v->type = t;
+        }
         while (ploc != sp) {
           ploc--;
           v = ploc->id;
@@ -821,6 +1149,7 @@ void decl(int bc)
           v->class = ploc->class;
           v->local = 0;
         }
+        if (tk == '{') { skipbody(); break; } // linked from the companion object
       } else {
         if (bc == Auto) {
           if (v->class && v->local) err("duplicate definition");
@@ -832,9 +1161,11 @@ void decl(int bc)
           v->local = 1;
         }
         else if (v->class) err("duplicate definition");
+        else if (object && sc == Static) *pdef++ = v;
 
         v->class = sc;
         v->type = t;
+        if (sc == Static) v->lib = lib;
         if (sc != Typedef) { // XXX typedefs local to functions?
           if ((t & TMASK) == ARRAY) v->class = (sc == Auto) ? Lea : Leag; // not lvalue if array
           size = tsize(t);
@@ -958,18 +1289,49 @@ void nodc(int n, N a, N b) // commutative
   if (a->i < b->i) { e[1].n = b; e[2].n = a; } else { e[1].n = a; e[2].n = b; } // put simpler expression in rhs
 }
 
+int lg2(uint n) { int k; for (k = 0; k < 32; k++) if (n == 1 << k) return k; return -1; }
+
+void scale(N b, N c) // b * constant c, a shift when c is a power of two
+{
+  int k;
+  if ((k = lg2(c[2].u)) > 0) { c[2].i = k; node(Shl,b,c); } else nodc(Mul,b,c);
+}
+
 void mul(N b) // XXX does this handle unsigned correctly?
 {
+  N c, d; int k;
   if (b->i == Num) {
     if (e->i == Num) { e[2].i *= b[2].i; return; }
     if (b[2].i == 1) return;
+    c = b; b = e;
+  } else if (e->i == Num) {
+    if (e[2].i == 1) { e = b; return; } // XXX reliable???
+    c = e;
+  } else { nodc(Mul,e,b); return; }
+
+  for (;;) { // (x * k) * c -> x * (k * c)
+    if (b->i == Mul && b[2].n->i == Num) c[2].i *= b[2].n[2].i;
+    else if (b->i == Shl && b[2].n->i == Num && b[2].n[2].u < 32) c[2].i <<= b[2].n[2].i;
+    else break;
+    b = b[1].n;
   }
-  if (e->i == Num && e[2].i == 1) { e = b; return; } // XXX reliable???
-  nodc(Mul,e,b);
+  if (b->i == Add && b[2].n->i == Num) { // (x + k) * c -> x * c + k * c so the constant can fold into an address
+    k = b[2].n[2].i * c[2].i; // XXX k may be shared with a post-increment, leave it alone
+    scale(b[1].n, c);
+    d = e; (e-=4)->i = Num; e[2].i = k;
+    node(Add,d,e);
+  } else scale(b, c);
+}
+
+int fold(N a, N k) // add constant k into a constant or address
+{
+  if (a->i == Num || a->i == Lea || (a->i == Leag && k[2].i >= 0)) { a[2].u += k[2].u; return 1; } // XXX keep globals from crossing BSS_TAG
+  return 0;
 }
 
-void add(N b)  // XXX make sure to optimize (a + 9 + 2) -> (a + 11)    and    (a + 9 - 2) -> (a + 7)
+void add(N b)
 {
+  N k;
   if (b->i == Num) {
     if (e->i == Num || e->i == Lea || e->i == Leag) { e[2].u += b[2].u; return; } // XXX  <<>> check
     if (!b[2].i) return;
@@ -979,9 +1341,69 @@ void add(N b)  // XXX make sure to optimize (a + 9 + 2) -> (a + 11)    and    (a
     if (b->i == Leag) { e[2].u += b[2].u; e->i = Leag; return; }
     if (!e[2].i) { e = b; return; } // XXX reliable???
   }
+  // (x + k) + y -> (x + y) + k so constants collect at the top, where they fold into a constant or address
+  if (e->i == Add && (k = e[2].n)->i == Num) {
+    if (fold(b,k)) { e = e[1].n; add(b); return; }
+    nodc(Add,b,e[1].n); node(Add,e,k);
+    return;
+  }
+  if (b->i == Add && (k = b[2].n)->i == Num) {
+    if (fold(e,k)) { add(b[1].n); return; }
+    nodc(Add,b[1].n,e); node(Add,e,k);
+    return;
+  }
   nodc(Add,b,e);
 }
 
+N eqk(N b) // (x + k) == c -> x == c - k
+{
+  if (e->i == Num && b->i == Add && b[2].n->i == Num) { e[2].i -= b[2].n[2].i; return b[1].n; }
+  if (b->i == Num && e->i == Add && e[2].n->i == Num) { b[2].i -= e[2].n[2].i; e = e[1].n; }
+  return b;
+}
+
+void ivref(void) // base[i] with i the induction variable of an enclosing loop becomes a hidden pointer plus a constant
+{
+  N a, x, s; int c, i, j, k, m; iv_t *v; loc_t *p;
+
+  if (iret != -1) return;
+  a = e; c = 0;
+  if (a->i == Add && a[2].n->i == Num) { c = a[2].n[2].i; a = a[1].n; }
+  if (a->i != Add) return;
+  for (k = 0; k < 2; k++) {
+    x = a[2-k].n; s = a[1+k].n; m = 1;
+    if ((s->i == Shl || s->i == Mul) && s[2].n->i == Num) { m = (s->i == Shl) ? 1 << s[2].n[2].i : s[2].n[2].i; s = s[1].n; }
+    if (s->i != Auto || (x->i != Lea && x->i != Leag && x->i != Auto)) continue;
+    for (i = niv - 1; i >= 0 && ivs[i].v != s[2].i; i--) ;
+    if (i < 0) continue;
+    v = ivs + i;
+    if (x->i == Auto) { // the base must not change while the loop runs
+      for (p = pframe; p < ploc && (p->id->class != Auto || p->id->val != x[2].i); p++) ;
+      if (p < ploc) { // a pointer local the loop doesn't write
+        if (!(p->id->type & PMASK) || p->id->local != 1 || v->nw < 0) continue;
+        for (j = 0; j < v->nw && v->w[j] != x[2].i; j++) ;
+        if (j < v->nw) continue;
+      } else { // or an outer loop's hidden pointer
+        for (j = 0; j < i && (x[2].i > ivs[j].slot || x[2].i <= ivs[j].slot - ivs[j].max*4); j++) ;
+        if (j == i) continue;
+      }
+    }
+    for (j = 0; j < v->n; j++) {
+      if (v->kind[j] != x->i || v->scale[j] != m) continue;
+      if (x->i == Auto) { if (v->base[j] == x[2].i) break; }
+      else if ((x->i == Lea || ((uint)v->base[j] < BSS_TAG) == (x[2].u < BSS_TAG)) && (x[2].i - v->base[j] + c)<<8>>8 == x[2].i - v->base[j] + c) break;
+    }
+    if (j == v->n) {
+      if (j == v->max) return;
+      v->kind[j] = x->i; v->base[j] = x[2].i; v->scale[j] = m; v->n++;
+    }
+    if (x->i != Auto) c += x[2].i - v->base[j];
+    (e-=4)->i = Auto; e[1].i = INT; e[2].i = v->slot - j*4; e[3].n = 0;
+    if (c) { (e-=4)->i = Num; e[2].i = c; node(Add,e+4,e); }
+    return;
+  }
+}
+
 N flot(N b, uint t)
 {
   if (t == DOUBLE || t == FLOAT) return b;
@@ -1089,9 +1511,11 @@ void expr(int lev)
   case Id:
     if (id->class) {
       (e-=4)->i = id->class; e[1].i = ty = id->type; if (id->class == FFun) e[2].n = (N)id; else e[2].i = id->val;
+      e[3].n = (N)id;
       next();
       break;
     }
+    if (object) *pdef++ = id;
     id->class = FFun;
     ffun++;
     ty = id->type = FUN | ((vp-va)<<TSHIFT);
@@ -1140,6 +1564,22 @@ void expr(int lev)
     next(); expr(Inc); addr();
     break;
 
+  case Lan: // address of a label, for goto *
+    next();
+    if (tk != Id) { err("bad label address"); break; }
+    if (!id->class) {
+      ploc->class = 0;
+      ploc->id = id;
+      ploc++;
+      id->class = FLabel;
+      id->val = 0;
+    }
+    else if (id->class != Label && id->class != FLabel) err("bad label name");
+    (e-=4)->i = Label; e[2].n = (N)id;
+    ty = VOID + PTR;
+    next();
+    break;
+
   case '!':
     next(); expr(Inc);
     switch (e->i) {
@@ -1319,24 +1759,24 @@ void expr(int lev)
     case Eq:
       next(); expr(Lt);
       if ((t < FLOAT || (t & PAMASK)) && (ty < FLOAT || (ty & PAMASK)))
-        { if (b->i == Num && e->i == Num) e[2].i = b[2].i == e[2].i; else nodc(Eq,b,e); }
+        { if (b->i == Num && e->i == Num) e[2].i = b[2].i == e[2].i; else { b = eqk(b); nodc(Eq,b,e); } }
       else if ((tt=t|ty) >= STRUCT) err("bad operands to ==");
       else if (tt & FLOAT) {
         d = flot(e,ty); b = flot(b,t);
         if (b->i == Numf && d->i == Numf) { e->i = Num; e[2].i = *(double *)(b+2) == *(double *)(d+2); } else nodc(Eqf,b,d);
-      } else { if (b->i == Num && e->i == Num) e[2].i = b[2].i == e[2].i; else nodc(Eq,b,e); }
+      } else { if (b->i == Num && e->i == Num) e[2].i = b[2].i == e[2].i; else { b = eqk(b); nodc(Eq,b,e); } }
       ty = INT;
       continue;
 
     case Ne:
       next(); expr(Lt);
       if ((t < FLOAT || (t & PAMASK)) && (ty < FLOAT || (ty & PAMASK)))
-        { if (b->i == Num && e->i == Num) e[2].i = b[2].i != e[2].i; else nodc(Ne,b,e); }
+        { if (b->i == Num && e->i == Num) e[2].i = b[2].i != e[2].i; else { b = eqk(b); nodc(Ne,b,e); } }
       else if ((tt=t|ty) >= STRUCT) err("bad operands to !=");
       else if (tt & FLOAT) {
         d = flot(e,ty); b = flot(b,t);
         if (b->i == Numf && d->i == Numf) { e->i = Num; e[2].i = *(double *)(b+2) != *(double *)(d+2); } else nodc(Nef,b,d);
-      } else { if (b->i == Num && e->i == Num) e[2].i = b[2].i != e[2].i; else nodc(Ne,b,e); }
+      } else { if (b->i == Num && e->i == Num) e[2].i = b[2].i != e[2].i; else { b = eqk(b); nodc(Ne,b,e); } }
       ty = INT;
       continue;
 
@@ -1420,9 +1860,7 @@ void expr(int lev)
       next(); expr(Mul);
       if ((t & PAMASK) && (ty & PAMASK) && (tt=tinc(t)) == tinc(ty)) {
         node(Sub,b,e);
-        d = e;
-        (e-=4)->i = Num; e[2].i = tt;
-        node(Div,d,e);
+        if (tt > 1) { d = e; (e-=4)->i = Num; e[2].i = tt; node(Div,d,e); }
         ty = INT;
       } else if ((t & PAMASK) && ty <= UINT) {
         if ((tt = tinc(t)) > 1) { (e-=4)->i = Num; e[2].i = tt; mul(e+4); }
@@ -1463,14 +1901,14 @@ void expr(int lev)
         } else node(Divf,b,d);
         ty = DOUBLE;
       }
-      else if (tt & UINT) { if (b->i == Num && e->i == Num && e[2].u) e[2].u = b[2].u / e[2].u; else node(Dvu,b,e); ty = UINT; }
-      else { if (b->i == Num && e->i == Num && e[2].i) e[2].i = b[2].i / e[2].i; else node(Div,b,e); ty = INT; }
+      else if (tt & UINT) { if (b->i == Num && e->i == Num && e[2].u) e[2].u = b[2].u / e[2].u; else if (e->i == Num && lg2(e[2].u) >= 0) { if (e[2].u == 1) e = b; else { e[2].i = lg2(e[2].u); node(Sru,b,e); } } else node(Dvu,b,e); ty = UINT; }
+      else { if (b->i == Num && e->i == Num && e[2].i) e[2].i = b[2].i / e[2].i; else if (e->i == Num && e[2].i == 1) e = b; else node(Div,b,e); ty = INT; }
       continue;
 
     case Mod:
       next(); expr(Inc);
       if ((tt=t|ty) >= FLOAT) err("bad operands to %");
-      else if (tt & UINT) { if (b->i == Num && e->i == Num && e[2].u) e[2].u = b[2].u % e[2].u; else node(Mdu,b,e); ty = UINT; }
+      else if (tt & UINT) { if (b->i == Num && e->i == Num && e[2].u) e[2].u = b[2].u % e[2].u; else if (e->i == Num && lg2(e[2].u) >= 0) { e[2].u--; nodc(And,b,e); } else node(Mdu,b,e); ty = UINT; }
       else { if (b->i == Num && e->i == Num && e[2].i) e[2].i = b[2].i % e[2].i; else node(Mod,b,e); ty = INT; }
       continue;
 
@@ -1512,6 +1950,7 @@ found:
       (e-=4)->i = Num; e[2].i = tinc(t);
       mul(d);
       add(b);
+      if (niv) ivref();
       ty = t;
       ind();
       continue;
@@ -1779,10 +2218,139 @@ int testnot(N a, int t)
   }
 }
 
+// asm() stubs
+int argref(int i) // instruction addresses an argument slot
+{
+  switch (i & 0xff) {
+  case LL ... LLF: case LBL ... LBLF: case LCL: case LEA: return 1;
+  }
+  return 0;
+}
+
+// remember a function made only of a few argument loads and register operations, so calls can expand it
+void stubdef(ident_t *v)
+{
+  int i, n, *p;
+  if ((n = (ip - 4 - pbody[-2]) / 4) > STUB_SZ) return;
+  for (i = 0; i < n; i++) {
+    p = (int *)(ts + pbody[-2]) + i;
+    if (argref(*p)) { if ((*p >> 8) < 8) return; }
+    else switch (*p & 0xff) {
+    case MCPY: case MCMP: case MCHR: case MSET: case TRAP: case POW ... FMOD: break;
+    default: return;
+    }
+  }
+  p = (int *)vp; vp += (n * 4 + 11) & -8;
+  *p = n;
+  memcpy(p + 1, (void *)(ts + pbody[-2]), n * 4);
+  v->stub = (long)p - va;
+}
+
+// expand a stub without using the stack when it loads each argument once into a register up front and
+// every argument is a constant, a variable or an address.  otherwise return 0 and emit nothing
+int stubreg(int *s, N b)
+{
+  int i, j, k, n, na, op, reg[4]; N arg[4];
+
+  for (na = 0; b; b = b->n) { if (na == 4) return 0; arg[na++] = b; }
+  for (k = 0; k < na; k++) {
+    switch ((arg[k]+2)->i) { case Num: case Numf: case Auto: case Static: case Lea: case Leag: break; default: return 0; }
+    reg[k] = 0;
+  }
+  for (n = *s++, i = 0; i < n && argref(s[i]) && (op = s[i] & 0xff) != LEA; i++) { // argument loads
+    k = na - 1 - ((s[i] >> 8) - 8) / 8; // list is last argument first
+    if ((s[i] >> 8) & 7 || k < 0 || reg[k]) return 0;
+    if (op == LLD || op == LBLD) { if (arg[k][1].i != DOUBLE && arg[k][1].i != FLOAT) return 0; }
+    else if (arg[k][1].i >= FLOAT && arg[k][1].i <= DOUBLE) return 0;
+    else if (op == LBLB) { if ((arg[k]+2)->i != Num) return 0; }
+    else if (op != LL && op != LBL && op != LCL) return 0;
+    for (j = 0; j < na; j++) if (reg[j] && (reg[j] == LBLB ? LBL : reg[j]) == (op == LBLB ? LBL : op)) return 0; // one argument per register
+    reg[k] = op;
+  }
+  for (k = i; k < n; k++) if (argref(s[k]) && (k != n-1 || s[k] != LL+(8<<8) || reg[na-1] != LL)) return 0; // except reloading the first
+
+  for (k = 0; k < na; k++) // b, c and g through a and f
+    switch (reg[k]) {
+    case LBL:  rv(arg[k]+2); em(LBA); break;
+    case LCL:  rv(arg[k]+2); em(LCA); break;
+    case LBLD: rv(arg[k]+2); em(LBAD); break;
+    case LBLB: lbi((arg[k]+2)[2].i & 0xff); break;
+    }
+  for (k = 0; k < na; k++) if (reg[k] == LL || reg[k] == LLD) rv(arg[k]+2);
+  if (s[n-1] == LL+(8<<8) && i < n) { em(PSHA); for (; i < n-1; i++) em(s[i]); em(POPA); }
+  else for (; i < n; i++) em(s[i]);
+  return 1;
+}
+
+// small functions
+void inlinedef(ident_t *v, char *body, loc_t *sp)
+{
+  inline_t *f;
+  if (ploc - sp > INLINE_NP) return;
+  f = (inline_t *) vp; vp += (sizeof(inline_t) + 7) & -8;
+  f->body = body;
+  f->rt = rt;
+  f->size = (ip - pbody[-2]) / 4;
+  f->busy = 0;
+  for (f->np = 0; sp < ploc; sp++, f->np++) {
+    f->pid[f->np] = (long)sp->id - va;
+    f->ptype[f->np] = sp->id->type;
+    f->pval[f->np] = sp->id->val;
+  }
+  v->inl = (long)f - va;
+}
+
+void swaplocal(loc_t *p)
+{
+  loc_t t;
+  memcpy(&t, p, sizeof(t));
+  p->class = p->id->class; p->type = p->id->type; p->val = p->id->val;
+  p->id->class = t.class; p->id->type = t.type; p->id->val = t.val;
+}
+
+// replay the body of a small function with its parameters bound to the arguments just pushed
+void expand(inline_t *f)
+{
+  int i, stk, sival, sline, sret; uint sty, srt; char *spos; ident_t *sid, *v; double sfval; loc_t *sp;
+
+  spos = pos; stk = tk; sid = id; sival = ival; sfval = fval; sty = ty; sline = line; srt = rt; sret = iret;
+  for (sp = ploc; sp > pframe; ) swaplocal(--sp); // the body sees what it saw where it was defined
+  for (sp = ploc, i = 0; i < f->np; i++, ploc++) {
+    v = (ident_t *)(va + f->pid[i]);
+    ploc->class = v->class; ploc->type = v->type; ploc->val = v->val; ploc->id = v;
+    v->class = Auto;
+    v->type = f->ptype[i];
+    v->val = loc + f->pval[i] - 8; // no return address below the arguments
+  }
+  f->busy = 1;
+  rt = f->rt;
+  iret = 0;
+  pos = f->body;
+  next();
+  while (tk != '}') stmt();
+  patch(iret, ip);
+  f->busy = 0;
+  while (ploc != sp) { ploc--; v = ploc->id; v->class = ploc->class; v->type = ploc->type; v->val = ploc->val; }
+  for (sp = pframe; sp < ploc; sp++) swaplocal(sp);
+  pos = spos; tk = stk; id = sid; ival = sival; fval = sfval; ty = sty; line = sline; rt = srt; iret = sret;
+}
+
+int pushargs(N b) // push the arguments of a call and return the bytes pushed
+{
+  int t;
+  for (t = 0; b; t += 8) {
+    if (b[1].i == DOUBLE || b[1].i == FLOAT) { rv(b+2); loc -= 8; em(PSHF); }
+    else if (b[2].i == Num && b[4].i<<8>>8 == b[4].i) { loc -= 8; emi(PSHI,b[4].i); }
+    else { rv(b+2); loc -= 8; em(PSHA); }
+    b = b->n;
+  }
+  return t;
+}
+
 void rv(N a)
 {
-  int c, t; N b; double d;
-  ident_t *n;
+  int c, t, *s; N b; double d;
+  ident_t *n; inline_t *f;
 
   switch (a->i) {
   case Addaf: opaf(a, ADDF, 1); return;
@@ -1928,24 +2496,32 @@ void rv(N a)
   case Auto:   eml(LL+lmod(a[1].i), a[2].i); return;
   case Static: emg(LG+lmod(a[1].i), a[2].i); return;
 
-  case Fun: emj(LEAG, a[2].i); return;
+  case Fun: *pfun++ = ip; emj(LEAG, a[2].i); return;
 
   case FFun:
     n = (ident_t *)a[2].n;
+    *pfun++ = ip;
     n->val = emf(LEAG, n->val);
     return;
 
+  case Label:
+    n = (ident_t *)a[2].n;
+    *pfun++ = ip;
+    if (n->class == Label) emj(LEAG, n->val); else n->val = emf(LEAG, n->val);
+    return;
+
   case Fcall:
     b = a[2].n;
     a = a[1].n;
-    for (t = 0; b; t += 8) {
-      if (b[1].i == DOUBLE || b[1].i == FLOAT) { rv(b+2); loc -= 8; em(PSHF); }
-      else if (b[2].i == Num && b[4].i<<8>>8 == b[4].i) { loc -= 8; emi(PSHI,b[4].i); }
-      else { rv(b+2); loc -= 8; em(PSHA); }
-      b = b->n;
-    }
-    if (a->i == FFun) { n = (ident_t *)a[2].n; n->val = emf(JSR, n->val); }
-    else if (a->i == Fun) emj(JSR, a[2].i);
+    s = (a->i == Fun && (n = (ident_t *)a[3].n)->stub) ? (int *)(va + n->stub) : 0;
+    if (s && stubreg(s, b)) return;
+    f = (optimize && a->i == Fun && (n = (ident_t *)a[3].n)->inl) ? (inline_t *)(va + n->inl) : 0;
+    if (f && (f->busy || f->size > optimize)) f = 0;
+    t = pushargs(b);
+    if (a->i == FFun) { n = (ident_t *)a[2].n; *pfun++ = ip; n->val = emf(JSR, n->val); }
+    else if (s) { for (c = 1; c <= *s; c++) em(argref(s[c]) ? s[c] - (8 << 8) : s[c]); } // no return address below the arguments
+    else if (f) expand(f);
+    else if (a->i == Fun) { *pfun++ = ip; emj(JSR, a[2].i); }
     else { rv(a); em(JSRA); } // function address
     if (t) { emi(ENT,t); loc += t; }
     return;
@@ -1955,12 +2531,239 @@ void rv(N a)
   }
 }
 
+// switch dispatch over the cases c[0], c[2] .. sorted by value (value, address pairs)
+int swrun(N c, int i, int n) // consecutive values with the same target starting at case i
+{
+  int j;
+  for (j = i + 1; j < n && c[j*2].i == c[j*2-2].i + 1 && c[j*2+1].i == c[i*2+1].i; j++) ;
+  return j - i;
+}
+
+void swtable(N c, int n, int def, int *brk, int last) // cases c[0] .. c[n*2-2] through a jump table
+{
+  int i, b, cmin, cmax;
+  cmin = c->i; cmax = c[n*2-2].i;
+  if (cmin > 0 && cmax <= n*8) cmin = 0;
+  else if (cmin) { opi(SUB, cmin); cmax -= cmin; }
+  lbi(++cmax);
+  data = (data + 3) & -4;
+  *(int *)(gs + data) = cmax; data += 4; // length ahead of the table for peep()
+  if (def) emj(BGEU, def); else *brk = emf(BGEU, *brk);
+  emg(JMPI, data);
+  b = ts+ip; // offsets are from the end of the JMPI, holes without a default land on the jump to the break
+  if (def) def -= b; else if (!last) *brk = emf(JMP, *brk);
+  for (i = 0; i < cmax; ) ((int *)(gs + data))[i++] = def;
+  for (i = 0; i < n; i++) ((int *)(gs + data))[c[i*2].i - cmin] = c[i*2+1].i - b;
+  data += cmax * 4;
+}
+
+void swtree(N c, N cl, int lo, int hi, int def, int *brk, int last) // clusters cl[lo] .. cl[hi]
+{
+  int i, j, k, t, m; // XXX lots of possible signed/unsigned under/overflow issues here too
+  for (t = -1, m = 0, k = lo; k <= hi; k++) if (swrun(c, cl[k].i, cl[k+1].i) != cl[k+1].i - cl[k].i) { t = k; m++; }
+  if (hi - lo < 3 && m <= 1) { // compare in line
+    for (k = lo; k <= hi; k++) {
+      if (k == t) continue;
+      i = cl[k].i; j = cl[k+1].i - 1;
+      if (i == j) { lbi(c[i*2].i); emj(BE, c[i*2+1].i); }
+      else if (c[j*2].i == 0x7fffffff) { lbi(c[i*2].i); emj(BGE, c[i*2+1].i); } // range to the top, where + 1 would wrap
+      else { lbi(c[i*2].i); m = emf(BLT, 0); lbi(c[j*2].i + 1); emj(BLT, c[i*2+1].i); patch(m, ip); } // range
+    }
+    if (t >= 0) swtable(c + cl[t].i*2, cl[t+1].i - cl[t].i, def, brk, last);
+    else if (def) emj(JMP, def);
+    else if (!last) *brk = emf(JMP, *brk);
+  } else { // binary search
+    m = (lo + hi + 1) / 2;
+    lbi(c[cl[m].i*2].i);
+    k = emf(BLT, 0);
+    swtree(c, cl, m, hi, def, brk, 0);
+    patch(k, ip);
+    swtree(c, cl, lo, m - 1, def, brk, last);
+  }
+}
+
 // statement
+void ivw(iv_t *v, ident_t *x) // note a local written in the loop
+{
+  int i;
+  if (v->nw < 0) return;
+  for (i = 0; i < v->nw; i++) if (v->w[i] == x->val) return;
+  if (v->nw == IV_NW) v->nw = -1; else v->w[v->nw++] = x->val;
+}
+
+void ivlocals(void) // mark the locals of the current function whose address is taken
+{
+  int stk, sival, sline, sdata, sop, sdebug, d, a; uint sty; char *spos; ident_t *sid; double sfval;
+
+  spos = pos; stk = tk; sid = id; sival = ival; sfval = fval; sty = ty; sline = line; sdata = data; sop = opaque; sdebug = debug;
+  pos = fbody; line = fline; debug = 0; ivaddr = 1;
+  for (a = d = 0; ; ) {
+    next();
+    if (!tk) break;
+    if (tk == '{') d++;
+    else if (tk == '}' && !d--) break;
+    else if (tk == Va_start) ivaddr = 2;
+    else if (tk == Id && a && id->local) id->local = 2;
+    a = (tk == And || (a && tk == Paren));
+  }
+  pos = spos; tk = stk; id = sid; ival = sival; fval = sfval; ty = sty; line = sline; memset((char *)(gs + sdata), 0, data - sdata); data = sdata; opaque = sop; debug = sdebug;
+}
+
+// look ahead from a for loop condition for an int local stepped by a constant and used to index arrays
+int ivscan(iv_t *v)
+{
+  int stk, sival, sline, sdata, sop, sdebug, c, d, n, p, pre, brace, part, blk; uint sty; char *spos, el[IV_NB]; ident_t *sid, *x, *w; double sfval;
+
+  if (!ivaddr) ivlocals();
+  if (ivaddr == 2) return 0;
+  spos = pos; stk = tk; sid = id; sival = ival; sfval = fval; sty = ty; sline = line; sdata = data; sop = opaque; sdebug = debug;
+  debug = 0;
+
+  for (d = 0; tk && (d || tk != ';'); next()) { if (tk == Paren || tk == Brak) d++; else if (tk == ')' || tk == ']') d--; }
+  x = 0;
+  if (tk) {
+    next();
+    if (tk == Inc || tk == Dec) { v->step = (tk == Inc) ? 1 : -1; next(); if (tk == Id) { x = id; next(); } }
+    else if (tk == Id) {
+      x = id; next();
+      if (tk == Inc || tk == Dec) { v->step = (tk == Inc) ? 1 : -1; next(); }
+      else if ((tk == Adda || tk == Suba) && (c = tk, next(), tk == Num)) { v->step = (c == Adda) ? ival : -ival; next(); }
+      else x = 0;
+    }
+    if (tk != ')') x = 0;
+  }
+  c = 0;
+  if (x && x->class == Auto && x->local == 1 && (x->type == INT || x->type == UINT)) {
+    pos = spos; tk = stk; id = sid; ival = sival; line = sline; memset((char *)(gs + sdata), 0, data - sdata); data = sdata; // strings read ahead
+    v->v = x->val; v->nw = v->n = 0;
+    w = 0; d = n = p = pre = brace = part = blk = 0;
+    for (;;) {
+      if (!tk || tk == Goto || tk == Asm) { c = 0; break; }
+      if (!part && !d && tk == ';') { // skip the step, then the body
+        while (tk != ')') next();
+        next();
+        part = 1; blk = (tk == '{'); p = ';';
+        continue;
+      }
+      if (w && tk != ')') { if ((tk >= Assign && tk <= Shra) || tk == Inc || tk == Dec) ivw(v, w); w = 0; }
+      if (tk == Id) {
+        if (*pos == ':' && (p == ';' || p == '{' || p == '}' || p == ')')) { c = 0; break; } // label
+        if (id->class == Auto && id->local) { if (pre) ivw(v, id); w = id; }
+        if (id == x && n && n <= IV_NB && el[n-1]) c++;
+      }
+      pre = (tk == Inc || tk == Dec || tk == And || (pre && tk == Paren));
+      if (tk == Brak) {
+        if (n < IV_NB) el[n] = (p == ']' || (p == Id && (id->class == Lea || id->class == Leag || (id->class == Auto && (id->type & PMASK)))));
+        n++; d++;
+      }
+      else if (tk == ']') { n--; d--; }
+      else if (tk == Paren) d++;
+      else if (tk == ')') d--;
+      else if (tk == '{') brace++;
+      else if (part && tk == '}') { if (!brace || (!--brace && blk)) break; }
+      else if (part && tk == ';' && !d && !brace && !blk) {
+        next();
+        if (tk != Else && tk != While) break; // else or do's while belong to the statement
+        p = ';';
+        continue;
+      }
+      p = tk;
+      next();
+    }
+    for (d = 0; d < v->nw && v->w[d] != x->val; d++) ;
+    if (v->nw < 0 || d < v->nw) c = 0;
+  }
+  pos = spos; tk = stk; id = sid; ival = sival; fval = sfval; ty = sty; line = sline; memset((char *)(gs + sdata), 0, data - sdata); data = sdata; opaque = sop; debug = sdebug;
+  v->max = (c > IV_NP) ? IV_NP : (c + 1) & -2; // keep the stack 8 byte aligned
+  return c;
+}
+
+void ivstep(iv_t *v) // advance the hidden pointers with the variable
+{
+  int i;
+  for (i = 0; i < v->n; i++) { eml(LL, v->slot - i*4); opi(ADD, v->step * v->scale[i]); eml(SL, v->slot - i*4); }
+}
+
+void ivpre(iv_t *v, int d, int c) // leave the loop's frame, and emit the loop entry d that sets up the hidden pointers and jumps to c
+{
+  int i, o; N b, es;
+
+  emi(ENT, v->max * 4); loc += v->max * 4;
+  o = emf(JMP, 0);
+  patch(d, ip);
+  emi(ENT, -v->max * 4); loc -= v->max * 4;
+  es = e;
+  for (i = 0; i < v->n; i++) {
+    (e-=4)->i = Auto; e[1].i = INT; e[2].i = v->v; e[3].n = 0;
+    if (v->scale[i] > 1) { (e-=4)->i = Num; e[2].i = v->scale[i]; mul(e+4); }
+    b = e; (e-=4)->i = v->kind[i]; e[1].i = INT; e[2].i = v->base[i]; e[3].n = 0;
+    add(b);
+    rv(e);
+    e = es;
+    eml(SL, v->slot - i*4);
+  }
+  emj(JMP, ts + c);
+  loc += v->max * 4;
+  patch(o, ip);
+  niv--;
+}
+
+int argreads(N a, int v) // might evaluating a read the parameter slot v
+{
+  switch (a->i) {
+  case Num: case Numf: case Static: case Leag: case Fun: return 0;
+  case Auto: return (a[2].i & -8) == v;
+  case Ptr: return argreads(a+2, v);
+  case Add: case Sub: case Mul: case Div: case Dvu: case Mod: case Mdu:
+  case And: case Or: case Xor: case Shl: case Shr: case Sru:
+  case Eq: case Ne: case Lt: case Ge: case Ltu: case Geu:
+    return argreads(a[1].n, v) || argreads(a[2].n, v);
+  default: return 1;
+  }
+}
+
+// tail call: return f(...) from a function whose frame nothing points into.  the arguments go straight
+// over the caller's own (f can take no more than it got) when no later one reads the slot, the rest are
+// pushed and popped into place, and f is jumped to
+int tailcall(N a)
+{
+  int t, c, d, np, ps[16]; N b, x; ident_t *n; loc_t *p;
+
+  b = a[2].n;
+  a = a[1].n;
+  if (a->i == Fun) {
+    n = (ident_t *)a[3].n;
+    if (n->stub || (n->inl && ((inline_t *)(va + n->inl))->size <= optimize)) return 0; // expanded instead
+  }
+  else if (a->i != FFun) return 0;
+  for (t = 0, x = b; x; x = x->n) t++;
+  if (t > fargs) return 0; // at most 16, the type keeps two bits each
+  if (!ivaddr) ivlocals();
+  if (ivaddr == 2) return 0;
+  for (p = pframe; p < ploc; p++)
+    if ((n = p->id)->class == Auto && (n->local == 2 || (n->type & TMASK) == ARRAY || (n->type & TMASK) == STRUCT)) return 0;
+
+  for (np = 0, c = t * 8; b; b = b->n, c -= 8) { // the last argument comes first
+    d = (b[1].i == DOUBLE || b[1].i == FLOAT);
+    rv(b+2);
+    for (x = b->n; x && !argreads(x+2, c); x = x->n) ;
+    if (x) { loc -= 8; em(d ? PSHF : PSHA); ps[np++] = c | d; }
+    else eml(d ? SLD : SL, c);
+  }
+  while (np--) { d = ps[np] & 1; loc += 8; em(d ? POPF : POPA); eml(d ? SLD : SL, ps[np] - d); }
+  if (loc) emi(ENT, -loc);
+  *pfun++ = ip;
+  if (a->i == FFun) { n = (ident_t *)a[2].n; n->val = emf(JMP, n->val); }
+  else emj(JMP, a[2].i);
+  ntail++;
+  return 1;
+}
+
 void stmt(void)
 {
   static int brk, cont, def;
-  int a, b, c, d, cmin, cmax;
-  N es, et;
+  int a, b, c, d, t, cmin, cmax;
+  N es, et; iv_t *v;
 
   switch (tk) {
   case If:
@@ -2002,10 +2805,11 @@ void stmt(void)
       es = e;
       expr(Comma);
       cast(rt);
+      if (optimize && iret == -1 && e->i == Fcall && tailcall(e)) { e = es; skip(';'); return; }
       rv(e);
       e = es;
     }
-    emi(LEV,-loc);
+    if (iret != -1) iret = emf(JMP, iret); else emi(LEV,-loc);
     skip(';');
     return;
 
@@ -2029,12 +2833,14 @@ void stmt(void)
       e = es;
     }
     skip(';');
+    v = (optimize && iret == -1 && niv < IV_SZ && ivscan(ivs + niv)) ? ivs + niv++ : 0;
+    if (v) { v->slot = loc - 4; loc -= v->max * 4; } // hidden pointers below the locals while the loop runs
     es = et = 0;
     if (tk != ';') { es = e; expr(Comma); if (ty == DOUBLE || ty == FLOAT) (e-=2)->i = Nzf; }
     skip(';');
     if (tk != ')') { et = e; expr(Comma); }
     skip(')');
-    if (es) d = emf(JMP, 0);
+    if (es || v) d = emf(JMP, 0);
     a = ip;
     b = brk; brk = 0;
     c = cont; cont = 0;
@@ -2042,13 +2848,16 @@ void stmt(void)
     patch(cont, (es || et) ? ip : a);
     cont = c;
     if (et) { trim(); rv(e); e = et; }
+    if (v) ivstep(v);
+    t = ip;
     if (es) {
-      patch(d,ip);
+      if (!v) patch(d,ip);
       patch(test(e,0), a);
       e = es;
     } else
       emj(JMP, ts+a);
     patch(brk,ip); brk = b;
+    if (v) ivpre(v, d, t);
     return;
 
   case Do:
@@ -2083,25 +2892,22 @@ void stmt(void)
     patch(a,ip);
     if (es == e) { //err("no case in switch statement");   XXX
       if (def) emj(JMP, def);
-    } else {  // XXX lots of possible signed/unsigned under/overflow issues in this block
-      cmin = cmax = (et = es - 2)->i;
-      while (et > e) { et -= 2; if ((c = et->i) > cmax) cmax = c; else if (c < cmin) cmin = c; }
-      et = es;
-      if ((ulong)(cmax - cmin) <= (es - e)*8) { // jump table
-        if (cmin > 0 && cmax <= (es - e)*4) cmin = 0;
-        else if (cmin) { opi(SUB, cmin); cmax -= cmin; }
-        lbi(++cmax);
-        data = (data + 3) & -4;
-        if (def) { emj(BGEU, def); emg(JMPI, data); def -= ts+ip; }
-        else { brk = emf(BGEU, brk); emg(JMPI, data); }
-        for (c = 0; c < cmax; ) ((int *)(gs + data))[c++] = def;
-        while (et > e) { et -= 2; ((int *)(gs + data))[et->i - cmin] = et[1].i - (ts+ip); }
-        data += cmax * 4;
-      } else { // jump list
-//        printf("jump list at line %d\n",line);
-        while (et > e) { et -= 2; lbi(et->i); emj(BE, et[1].i); }  // XXX overflow issues?
-        if (def) emj(JMP, def);
+    } else {
+      for (cmax = (es - e) / 2, a = 1; a < cmax; a++) { // sort by value
+        c = e[a*2].i; t = e[a*2+1].i;
+        for (cmin = a; cmin && e[cmin*2-2].i > c; cmin--) { e[cmin*2].i = e[cmin*2-2].i; e[cmin*2+1].i = e[cmin*2-1].i; }
+        e[cmin*2].i = c; e[cmin*2+1].i = t;
       }
+      et = e - cmax - 1;
+      for (a = cmin = 0; a < cmax; a += c) { // cluster into ranges, jump tables and single values
+        et[cmin++].i = a;
+        if ((c = swrun(e, a, cmax)) < 3) {
+          for (c = cmax - 1; c - a >= 3 && (uint)(e[c*2].i - e[a*2].i) > (c - a + 1) * 16; c--) ;
+          c = (c - a >= 3) ? c - a + 1 : 1;
+        }
+      }
+      et[cmin].i = cmax;
+      swtree(e, et, 0, cmin - 1, def, &brk, 1);
     }
     def = d;
     e = es;
@@ -2121,6 +2927,7 @@ void stmt(void)
     return;
 
   case Asm:
+    opaque++;
     next();
     skip(Paren);
     a = imm();
@@ -2153,6 +2960,17 @@ void stmt(void)
 
   case Goto:
     next();
+    if (tk == Mul) { // to an address from &&label
+      next();
+      es = e;
+      expr(Comma);
+      rv(e);
+      e = es;
+      em(PSHA);
+      emi(LEV, 0);
+      skip(';');
+      return;
+    }
     if (tk == Id) {
       if (!id->class) {
         ploc->class = 0;
@@ -2207,15 +3025,963 @@ void stmt(void)
   }
 }
 
+// index of the function body containing text offset o
+int body(int *pb, int n, int o)
+{
+  int lo, hi, m;
+  lo = 0; hi = n - 1;
+  while (lo < hi) { m = (lo + hi + 1) / 2; if (pb[m*2] <= o) lo = m; else hi = m - 1; }
+  return lo;
+}
+
+// target of the function reference at text offset o
+int target(int o) { return o + 4 + (*(int *)(ts + o) >> 8); }
+
+// drop the function bodies not reachable from main (or for an object, from the functions outside include
+// files) and return the new text size
+int prune(int *pb, int *pf, int *patchdata, int *patchbss, long *amain)
+{
+  int i, j, n, nb, nr, o, r, t, *live, *first, *tb, *to, *work, *p, *q, *e; ident_t *v, **d;
+
+  nb = (pbody - pb) / 2;
+  nr = pfun - pf;
+  live  = memset(new(nb * sizeof(int)), 0, nb * sizeof(int));
+  first = new((nb + 1) * sizeof(int));
+  tb    = new(nr * sizeof(int));
+  to    = new(nb * sizeof(int));
+  work  = new(nb * sizeof(int));
+
+  // references are recorded in text order, so each body's are a run of the list
+  for (r = i = 0; i < nb; i++) { while (r < nr && pf[r] < pb[i*2]) r++; first[i] = r; }
+  first[nb] = nr;
+
+  // mark everything reachable from main through calls and taken addresses
+  n = 0;
+  if (*amain) live[work[n++] = body(pb, nb, *amain - ts)] = 1;
+  for (d = defs; d < pdef; d++)
+    if ((v = *d)->class == Fun && !v->lib && !live[j = body(pb, nb, v->val - ts)]) { live[j] = 1; work[n++] = j; }
+  while (n) {
+    i = work[--n];
+    for (r = first[i]; r < first[i+1]; r++)
+      if (!live[j = tb[r] = body(pb, nb, target(pf[r]))]) { live[j] = 1; work[n++] = j; }
+  }
+
+  // lay out the live bodies, then fix their references and move them down
+  for (o = n = i = 0; i < nb; i++) if (live[i]) { to[i] = o; o += pb[i*2+1] - pb[i*2]; n++; }
+  if (verbose) dprintf(2,"%s : %d of %d functions live, text %d -> %d\n", cmd, n, nb, ip, o);
+  for (i = 0; i < nb; i++) {
+    if (!live[i]) continue;
+    for (r = first[i]; r < first[i+1]; r++) {
+      t = target(pf[r]); j = tb[r];
+      t = to[j] + t - pb[j*2] - (to[i] + pf[r] - pb[i*2]) - 4;
+      *(int *)(ts + pf[r]) = (*(int *)(ts + pf[r]) & 0xff) | (t << 8);
+    }
+    for (p = (int *)(ts + pb[i*2]), e = (int *)(ts + pb[i*2+1]), q = (int *)(ts + to[i]); p < e; ) *q++ = *p++;
+  }
+
+  // remap the data and bss patch lists, dropping those in dead code.  they are in text order too
+  for (p = q = patchdata, i = 0; p < pdata; p++) { while (i < nb - 1 && pb[i*2+2] <= *p) i++; if (live[i]) *q++ = *p - pb[i*2] + to[i]; }
+  pdata = q;
+  for (p = q = patchbss, i = 0; p < pbss; p++) { while (i < nb - 1 && pb[i*2+2] <= *p) i++; if (live[i]) *q++ = *p - pb[i*2] + to[i]; }
+  pbss = q;
+  for (p = q = pf, i = 0; p < pfun; p++) { while (i < nb - 1 && pb[i*2+2] <= *p) i++; if (live[i]) *q++ = *p - pb[i*2] + to[i]; }
+  pfun = q;
+
+  if (*amain) { i = body(pb, nb, *amain - ts); *amain += to[i] - pb[i*2]; }
+  for (d = defs; d < pdef; d++) // where an object's functions and import stubs went, if anywhere
+    if (((v = *d)->class == Fun || v->class == FFun) && v->val)
+      v->val = live[j = body(pb, nb, v->val - ts)] ? v->val + to[j] - pb[j*2] : 0;
+  for (q = pb, i = 0; i < nb; i++) if (live[i]) { q[1] = to[i] + pb[i*2+1] - pb[i*2]; q[0] = to[i]; q += 2; }
+  pbody = q;
+  return o;
+}
+
+// peephole rules on adjacent instructions x y where nothing jumps to y
+int peeps[] = {
+  SL,  LL,  1, // store then load the same local or global: drop the load
+  SLD, LLD, 1,
+  SG,  LG,  1,
+  SGD, LGD, 1,
+  ENT, LEV, 2, // pop the call arguments then return: fold them together
+  ENT, ENT, 2,
+  LI,  BZ,  3, // branch on a constant: always or never
+  LI,  BNZ, 3,
+  0
+};
+
+int pinv[] = { BZ, BNZ, BE, BNE, BLT, BGE, BLTU, BGEU }; // branch pairs that are each other's opposite
+
+// how instructions touch a and b, for reuse()
+int rwa[] = { LEA, LEAG, CYC, LLS, LLH, LLC, LLB, LG, LGS, LGH, LGC, LGB, LHI, CDI, CDU, CLI, 0 }; // write a
+int rwb[] = { LBLS, LBLH, LBLC, LBLB, LBG, LBGS, LBGH, LBGC, LBGB, LBX, LBXS, LBXH, LBXC, LBXB, LBHI, 0 }; // write b
+int rwf[] = { LLD, LLF, LGD, LGF, LXD, LXF, LIF, LBLD, LBLF, LBGD, LBGF, LBXD, LBXF, LBIF, LBAD, // neither
+  ADDF, SUBF, MULF, DIVF, CID, CUD, NOP, LCA, 0 };
+int rsl[] = { SL, SLH, SLB, SLD, SLF, 0 }; // store a local
+int rsx[] = { SX, SXH, SXB, SXD, SXF, 0 }; // store through b, which may point at a local
+int rps[] = { PSHA, PSHI, PSHF, PSHB, PSHC, 0 }; // push
+int rpo[] = { POPB, POPF, POPA, POPC, 0 }; // pop
+
+// forget a tracked local that a store to offset o changes
+int rkill(int r, int o) { return ((r & 3) == 1 && (r >> 2) - o < 8 && o - (r >> 2) < 8) ? 0 : r; }
+int rmove(int r, int d) { return ((r & 3) != 1) ? r : ((r >> 2) + d < 0) ? 0 : r + (d << 2); }
+
+// drop loads of locals and constants that a or b already holds, in straight line code, and return the count
+int reuse(int *code, int n, int *ref, char *del)
+{
+  int i, j, c, x, v, ra, rx, rb, *p; char *eff;
+
+  eff = memset(new(256), 0, 256); // 0 unknown: forget everything
+  for (p = rwa; *p; p++) eff[*p] = 1;
+  for (p = rwb; *p; p++) eff[*p] = 2;
+  for (p = rwf; *p; p++) eff[*p] = 3;
+  for (p = rsl; *p; p++) eff[*p] = 4;
+  for (p = rsx; *p; p++) eff[*p] = 5;
+  for (p = rps; *p; p++) eff[*p] = 6;
+  for (p = rpo; *p; p++) eff[*p] = 7;
+  for (x = ADD; x <= GEF; x++) eff[x] = 1;
+  for (x = BZ; x <= BGEF; x++) eff[x] = 3;
+  for (x = POW; x <= FMOD; x++) eff[x] = 3;
+  for (x = LX; x <= LXB; x++) eff[x] = 8;
+  eff[SG] = eff[SGH] = eff[SGB] = eff[SGD] = eff[SGF] = 9;
+
+  // ra and rb are 0, a local offset << 2 | 1, or a constant << 2 | 2
+  // rx is 0, or the LX instruction that loaded a through the address in ra
+  for (c = ra = rx = rb = i = 0; i < n; i++) {
+    if (del[i]) continue;
+    if (ref[i]) ra = rx = rb = 0; // control flow merges here: peep() moves the count of each instruction it deletes on to the next one left
+    x = code[i] & 0xff; v = code[i] >> 8;
+    switch (x) {
+    case LL:
+      if (ra == (v << 2 | 1)) {
+        if (!rx) { del[i] = 1; c++; continue; }
+        for (j = i + 1; j < n && del[j]; j++) ;
+        if (j < n && !ref[j] && code[j] == rx) { del[i] = del[j] = 1; c += 2; i = j; continue; } // same load through it
+      }
+      ra = v << 2 | 1; rx = 0;
+      continue;
+    case LI:  if (ra == (v << 2 | 2) && !rx) { del[i] = 1; c++; } else { ra = v << 2 | 2; rx = 0; } continue;
+    case LBL: x = v << 2 | 1; break;
+    case LBI: x = v << 2 | 2; break;
+    case LBA: rb = rx ? 0 : ra; continue;
+    case ENT: ra = rmove(ra, -v); rb = rmove(rb, -v); continue;
+    default:
+      switch (eff[x]) {
+      case 0: ra = rx = rb = 0; continue;
+      case 1: ra = rx = 0; continue;
+      case 2: rb = 0; continue;
+      case 3: continue;
+      case 4: if (rx) ra = rx = 0; ra = rkill(ra, v); rb = rkill(rb, v); if (x == SL) ra = v << 2 | 1; continue;
+      case 5: if (rx || (ra & 3) == 1) ra = rx = 0; if ((rb & 3) == 1) rb = 0; continue;
+      case 6: ra = rmove(ra, 8); rb = rmove(rb, 8); continue;
+      case 7: if (x == POPA) ra = rx = 0; if (x == POPB) rb = 0; ra = rmove(ra, -8); rb = rmove(rb, -8); continue;
+      case 8: if (ra && !rx) rx = code[i]; else ra = rx = 0; continue;
+      case 9: if (rx) ra = rx = 0; continue;
+      }
+    }
+    if (rb == x) { del[i] = 1; c++; } // load b
+    else if (ra == x && !rx) { code[i] = LBA; rb = ra; c++; }
+    else rb = x;
+  }
+  return c;
+}
+
+// move the references to deleted instruction i on to j, the next one left, so ref[] stays exact
+void reref(int *t, int *ref, int n, int i, int j)
+{
+  int k;
+  if (!ref[i]) return;
+  for (k = 0; k < n; k++) if (t[k] == i) t[k] = j;
+  ref[j] += ref[i]; ref[i] = 0;
+}
+
+// improve the laid out text with the peephole rules, jump threading and dead code removal, and return the new text size
+int peep(int *pb, int *pf, int *patchdata, int *patchbss, long *amain)
+{
+  int i, j, k, m, n, r, x, y, pass, *code, *t, *ref, *to, *p, *q, *c, *ce; char *kind, *del, *pop;
+
+  code = (int *)ts;
+  n = ip / 4;
+  t    = memset(new(n * sizeof(int)), -1, n * sizeof(int)); // branch target index
+  ref  = memset(new((n + 1) * sizeof(int)), 0, (n + 1) * sizeof(int)); // references to each instruction
+  to   = new((n + 1) * sizeof(int));
+  kind = memset(new(n), 0, n); // 1 data, 2 bss, 3 function reference
+  del  = memset(new(n), 0, n);
+  pop  = memset(new(256), 0, 256); // opcodes that can start a match
+  for (p = peeps; *p; p += 3) pop[*p] = 1;
+  for (x = BZ; x <= BGEF; x++) pop[x] = 1;
+  pop[JMP] = pop[JMPI] = pop[LEV] = 1;
+
+  // find everything that can transfer control
+  for (p = patchdata; p < pdata; p++) {
+    kind[i = *p / 4] = 1;
+    if ((code[i] & 0xff) == JMPI) // switch table with its length ahead of it
+      for (q = (int *)(gs + (code[i] >> 8)), k = q[-1]; k--; ) ref[i + 1 + q[k] / 4]++;
+  }
+  for (p = patchbss; p < pbss; p++) kind[*p / 4] = 2;
+  for (p = pf; p < pfun; p++) { kind[i = *p / 4] = 3; ref[t[i] = target(*p) / 4]++; }
+  for (p = pb; p < pbody; p += 2) ref[*p / 4]++; // entry points for ld
+  ref[(int)(*amain - ts) / 4]++;
+  for (i = 0; i < n; i++)
+    if (!kind[i] && ((x = code[i] & 0xff) == JMP || (x >= BZ && x <= BGEF))) ref[t[i] = i + 1 + (code[i] >> 10)]++;
+
+  for (ce = to, i = 0; i < n; i++) if (pop[code[i] & 0xff]) *ce++ = i; // to[] is free until the layout
+  for (pass = 0, r = 1; r && pass < 8; pass++) {
+    for (r = 0, c = to; c < ce; c++) {
+      if (del[i = *c] || !pop[x = code[i] & 0xff]) continue;
+      for (j = i + 1; j < n && del[j]; j++) ;
+      if (t[i] >= 0 && kind[i] != 3) { // jump to a jump
+        for (k = t[i]; k < n && del[k]; k++) ;
+        if (k < n && k != i && (code[k] & 0xff) == JMP && kind[k] != 3 && t[k] != t[i]) { ref[t[i]]--; ref[t[i] = t[k]]++; r++; }
+        if (x == JMP && k == j && j < n) { del[i] = 1; ref[t[i]]--; reref(t, ref, n, i, j); r++; continue; } // to the next instruction
+      }
+      if (x == JMP || x == JMPI || x == LEV) // unreachable code
+        for (; j < n && !ref[j]; j++) if (!del[j]) { del[j] = 1; if (t[j] >= 0) ref[t[j]]--; r++; }
+      if (j >= n || ref[j]) continue;
+      y = code[j] & 0xff;
+      if (y == JMP && t[i] >= 0 && kind[i] != 3 && kind[j] != 3) { // branch over a jump
+        for (k = j + 1; k < n && del[k]; k++) ;
+        for (m = t[i]; m < n && del[m]; m++) ;
+        for (q = pinv; q < pinv + 8 && *q != x; q++) ;
+        if (q < pinv + 8 && m == k) {
+          code[i] = (code[i] & -256) | pinv[(q - pinv) ^ 1];
+          ref[t[i]]--; t[i] = t[j]; del[j] = 1; r++;
+          continue;
+        }
+      }
+      for (p = peeps; *p && (p[0] != x || p[1] != y); p += 3) ;
+      switch (*p ? p[2] : 0) {
+      case 1: if (code[i] >> 8 == code[j] >> 8 && kind[i] == kind[j]) { del[j] = 1; r++; } break;
+      case 2: code[j] = y | (((code[i] >> 8) + (code[j] >> 8)) << 8); del[i] = 1; reref(t, ref, n, i, j); r++; break; // jumps to i now land on j
+      case 3:
+        if ((y == BZ) == !(code[i] >> 8)) code[j] = (code[j] & -256) | JMP;
+        else { del[j] = 1; ref[t[j]]--; }
+        r++;
+      }
+    }
+  }
+
+  k = reuse(code, n, ref, del);
+  if (verbose) dprintf(2,"%s : %d loads of values already in a register\n", cmd, k);
+
+  // lay out what is left and fix up everything that refers to it
+  for (k = i = 0; i < n; i++) { to[i] = k; if (!del[i]) k += 4; }
+  to[n] = k;
+  for (p = patchdata; p < pdata; p++) {
+    if (del[i = *p / 4] || (code[i] & 0xff) != JMPI) continue;
+    for (q = (int *)(gs + (code[i] >> 8)), k = q[-1]; k--; ) q[k] = to[i + 1 + q[k] / 4] - to[i] - 4;
+  }
+  for (i = 0; i < n; i++) {
+    if (del[i]) continue;
+    if (t[i] >= 0) code[i] = (code[i] & 0xff) | (to[t[i]] - to[i] - 4) << 8;
+    code[to[i] / 4] = code[i];
+  }
+  for (p = q = patchdata; p < pdata; p++) if (!del[*p / 4]) *q++ = to[*p / 4];
+  pdata = q;
+  for (p = q = patchbss; p < pbss; p++) if (!del[*p / 4]) *q++ = to[*p / 4];
+  pbss = q;
+  for (p = pf; p < pfun; p++) *p = to[*p / 4];
+  for (p = pb; p < pbody; p++) *p = to[*p / 4];
+  *amain = ts + to[(int)(*amain - ts) / 4];
+  if (verbose) dprintf(2,"%s : peephole text %d -> %d\n", cmd, ip, to[n]);
+  return to[n];
+}
+
+// block b if it can be laid out next: not yet placed, and reached by the profiled run unless only cold ones remain
+int avail(int b, char *done, char *hot, int cold) { return (b >= 0 && !done[b] && (hot[b] || cold)) ? b : -1; }
+
+// lay out the blocks of each function by a branch profile from eu -p: the way out of a conditional branch taken
+// more often falls through, and blocks the profiled run never reached go to the end.  the profile must come from
+// a binary built the same way without -P.  returns the new text size
+int layout(int *pb, int *pf, int *patchdata, int *patchbss, long *amain)
+{
+  int i, j, k, b, c, f, m, n, r, s, x, nb, nx, cold, ninv, *code, *cnt, *t, *to, *nc, *nt, *blk, *bs, *ord, *p, *q;
+  char *kind, *lead, *hot, *done, *pr; struct stat st;
+
+  code = (int *)ts;
+  n = ip / 4;
+  if ((f = open(profile, O_RDONLY)) < 0 || fstat(f, &st)) { dprintf(2,"%s : error: can't open profile %s\n", cmd, profile); errs++; return ip; }
+  dep(profile, f); // a new profile invalidates the cached binary
+  i = read(f, pr = new(st.st_size), st.st_size);
+  close(f);
+
+  // magic and image size, then the offset, fall through and taken counts of each branch that ran
+  cnt = memset(new(n * 2 * sizeof(int)), 0, n * 2 * sizeof(int));
+  p = (int *)pr;
+  if (i != st.st_size || i < 8 || p[0] != PRF_MAGIC || p[1] != ((ip + 7) & -8) + ((data + 7) & -8)) goto stale;
+  for (p += 2; p + 3 <= (int *)(pr + i); p += 3) {
+    if ((p[0] & 3) || (uint)(j = p[0] / 4) >= n || (x = code[j] & 0xff) < BZ || x > BGEF) goto stale;
+    cnt[j*2] = p[1]; cnt[j*2+1] = p[2];
+  }
+
+  t    = memset(new(n * sizeof(int)), -1, n * sizeof(int)); // branch target index
+  kind = memset(new(n), 0, n); // 1 data, 2 bss, 3 function reference
+  to   = new((n + 1) * sizeof(int));
+  nc   = new(n * 2 * sizeof(int)); // new code, with at most a jump added per block
+  nt   = new(n * 2 * sizeof(int)); // and the old index of what each instruction targets
+  blk  = new(n * sizeof(int));
+  bs   = new((n + 1) * sizeof(int));
+  ord  = new(n * sizeof(int));
+  lead = new(n); hot = new(n); done = new(n);
+  for (p = patchdata; p < pdata; p++) kind[*p / 4] = 1;
+  for (p = patchbss; p < pbss; p++) kind[*p / 4] = 2;
+  for (p = pf; p < pfun; p++) { kind[i = *p / 4] = 3; t[i] = target(*p) / 4; }
+  for (i = 0; i < n; i++)
+    if (!kind[i] && ((x = code[i] & 0xff) == JMP || (x >= BZ && x <= BGEF))) t[i] = i + 1 + (code[i] >> 10);
+
+  for (ninv = m = i = 0, p = pb; i < n; p += 2) {
+    s = (p < pbody) ? *p / 4 : n;
+    for (; i < s; i++) { to[i] = m * 4; nt[m] = t[i]; nc[m++] = code[i]; } // outside any function
+    if (p >= pbody) break;
+    f = p[1] / 4;
+
+    // blocks start at the entry, at jump targets and after transfers of control
+    for (c = r = 0, j = s; j < f; j++) lead[j] = (j == s);
+    for (j = s; j < f; j++) {
+      x = code[j] & 0xff;
+      if (t[j] >= 0 && !kind[j]) { if (t[j] < s || t[j] >= f) r = 1; else lead[t[j]] = 1; }
+      if (kind[j] == 3 && t[j] >= s && t[j] < f) lead[t[j]] = 1; // &&label, reached by a goto *
+      if (x == JMPI && kind[j] == 1)
+        for (q = (int *)(gs + (code[j] >> 8)), k = q[-1]; k--; ) { if ((nx = j + 1 + q[k] / 4) < s || nx >= f) r = 1; else lead[nx] = 1; }
+      if (x == JMP || x == JMPI || x == LEV || (x >= BZ && x <= BGEF)) { if (j + 1 < f) lead[j + 1] = 1; c += cnt[j*2] + cnt[j*2+1]; }
+    }
+    if (r || !c) { for (; i < f; i++) { to[i] = m * 4; nt[m] = t[i]; nc[m++] = code[i]; } continue; } // never ran or can't tell
+    for (nb = 0, j = s; j < f; j++) { if (lead[j]) bs[nb++] = j; blk[j] = nb - 1; }
+    bs[nb] = f;
+
+    // hot blocks are reached from the entry without leaving a branch the way the profile never saw it go
+    memset(hot, 0, nb); hot[0] = 1;
+    for (j = s; j < f; j++) if (kind[j] == 3 && t[j] >= s && t[j] < f) hot[blk[t[j]]] = 1;
+    for (r = 1; r; ) {
+      for (r = b = 0; b < nb; b++) {
+        if (!hot[b]) continue;
+        j = bs[b+1] - 1; x = code[j] & 0xff; c = cnt[j*2] + cnt[j*2+1];
+        if (x == JMPI && kind[j] == 1) {
+          for (q = (int *)(gs + (code[j] >> 8)), k = q[-1]; k--; ) if (!hot[nx = blk[j + 1 + q[k] / 4]]) hot[nx] = r = 1;
+          continue;
+        }
+        if (t[j] >= 0 && !kind[j] && (x == JMP || !c || cnt[j*2+1]) && !hot[nx = blk[t[j]]]) hot[nx] = r = 1;
+        if (x != JMP && x != LEV && (t[j] < 0 || kind[j] || !c || cnt[j*2]) && b + 1 < nb && !hot[b+1]) hot[b+1] = r = 1;
+      }
+    }
+
+    // chain each block to its likely successor, starting over at the first block left when that is placed
+    memset(done, 0, nb);
+    for (cold = k = b = 0; ; ) {
+      done[ord[k++] = b] = 1;
+      if (k == nb) break;
+      j = bs[b+1] - 1; x = code[j] & 0xff;
+      nx = (b + 1 < nb && x != JMP && x != JMPI && x != LEV) ? b + 1 : -1;
+      if (t[j] >= 0 && !kind[j]) {
+        if (x == JMP) nx = avail(blk[t[j]], done, hot, cold);
+        else if (cnt[j*2+1] > cnt[j*2]) nx = (r = avail(blk[t[j]], done, hot, cold)) >= 0 ? r : avail(nx, done, hot, cold);
+        else nx = (r = avail(nx, done, hot, cold)) >= 0 ? r : avail(blk[t[j]], done, hot, cold);
+      } else nx = avail(nx, done, hot, cold);
+      if (nx < 0) {
+        for (nx = 0; nx < nb && avail(nx, done, hot, cold) < 0; nx++) ;
+        if (nx == nb) for (cold = 1, nx = 0; done[nx]; nx++) ;
+      }
+      b = nx;
+    }
+
+    // emit the blocks in that order, fixing up how each one ends
+    for (k = 0; k < nb; k++) {
+      b = ord[k]; nx = (k + 1 < nb) ? ord[k+1] : -1;
+      for (i = bs[b]; i < bs[b+1] - 1; i++) { to[i] = m * 4; nt[m] = t[i]; nc[m++] = code[i]; }
+      x = code[i] & 0xff; to[i] = m * 4;
+      if (t[i] >= 0 && !kind[i] && x == JMP) { if (nx != blk[t[i]]) { nt[m] = t[i]; nc[m++] = code[i]; } continue; } // dropped if to the next
+      for (q = pinv; q < pinv + 8 && *q != x; q++) ;
+      if (t[i] >= 0 && !kind[i] && nx == blk[t[i]] && nx != b + 1 && b + 1 < nb && q < pinv + 8) { // branch the other way
+        nt[m] = bs[b+1]; nc[m++] = (code[i] & -256) | pinv[(q - pinv) ^ 1]; ninv++;
+        continue;
+      }
+      nt[m] = t[i]; nc[m++] = code[i];
+      if (x != JMP && x != JMPI && x != LEV && b + 1 < nb && nx != b + 1) { nt[m] = bs[b+1]; nc[m++] = JMP; } // falls through no longer
+    }
+    i = f;
+  }
+  to[n] = m * 4;
+  if (m * 4 > SEG_SZ) { err("text segment exceeds maximum size"); return ip; }
+
+  // fix up everything that refers to the text
+  for (j = 0; j < m; j++) if (nt[j] >= 0) nc[j] = (nc[j] & 0xff) | (to[nt[j]] - j * 4 - 4) << 8;
+  for (p = patchdata; p < pdata; p++) {
+    if ((code[i = *p / 4] & 0xff) != JMPI) continue;
+    for (q = (int *)(gs + (code[i] >> 8)), k = q[-1]; k--; ) q[k] = to[i + 1 + q[k] / 4] - to[i] - 4;
+  }
+  for (p = patchdata; p < pdata; p++) *p = to[*p / 4];
+  for (p = patchbss; p < pbss; p++) *p = to[*p / 4];
+  for (p = pf; p < pfun; p++) *p = to[*p / 4];
+  for (p = pb; p < pbody; p++) *p = to[*p / 4];
+  *amain = ts + to[(int)(*amain - ts) / 4];
+  memcpy(code, nc, m * 4);
+  if (verbose) dprintf(2,"%s : layout text %d -> %d, %d branches inverted\n", cmd, ip, m * 4, ninv);
+  return m * 4;
+
+stale:
+  dprintf(2,"%s : warning: profile %s does not match the code, not used\n", cmd, profile);
+  return ip;
+}
+
+// write an executable
+int output(char *name, int text, int entry)
+{
+  int i; struct { uint magic, bss, entry, flags; } hdr;
+  if ((i = open(name, O_WRONLY | O_CREAT | O_TRUNC)) < 0) return -1;
+  hdr.magic = 0xC0DEF00D;
+  hdr.bss   = bss;
+  hdr.entry = entry;
+  hdr.flags = 0;
+  write(i, &hdr, sizeof(hdr));
+  write(i, (void *)ts, text);
+  write(i, (void *)gs, data);
+  close(i);
+  return 0;
+}
+
+// native x86-64 output.  the finished text is translated an instruction at a time: a, b and c live in eax, ecx
+// and ebx, f and g in xmm0 and xmm1, and sp is rsp, so stack frames, calls and returns keep their layout.
+// everything is loaded below 2G where the 32 bit pointers of the compiled code reach it
+void xo(char *s) // hex bytes
+{
+  int h;
+  for (; *s; s++) {
+    if (*s == ' ') continue;
+    h = (*s <= '9') ? *s - '0' : *s - 'a' + 10; s++;
+    xs[xp++] = h * 16 + ((*s <= '9') ? *s - '0' : *s - 'a' + 10);
+  }
+}
+
+void xw(int w) { xs[xp++] = w; xs[xp++] = w >> 8; xs[xp++] = w >> 16; xs[xp++] = w >> 24; }
+
+void xrel(int t) { xw(t - xp - 4); } // rel32 to native offset t
+
+void xmem(char *op, int r, int b, int d) // op with register r and memory [b + d] (rsp 4, rax 0, rcx 1, or -1 for absolute)
+{
+  xo(op);
+  if (b < 0) { xs[xp++] = r << 3 | 4; xs[xp++] = 0x25; xw(d); }
+  else if (d >= -128 && d < 128) { xs[xp++] = 0x40 | r << 3 | b; if (b == 4) xs[xp++] = 0x24; xs[xp++] = d; }
+  else { xs[xp++] = 0x80 | r << 3 | b; if (b == 4) xs[xp++] = 0x24; xw(d); }
+}
+
+char xld[] = "8b\0    0fbf\0  0fb7\0  0fbe\0  0fb6\0  f20f10\0f30f5a"; // load int short ushort char uchar double float
+
+void xst(int k, int b, int d) // store int ushort uchar double float
+{
+  switch (k) {
+  case 0: xmem("89", 0, b, d); break;
+  case 1: xmem("6689", 0, b, d); break;
+  case 2: xmem("88", 0, b, d); break;
+  case 3: xmem("f20f11", 0, b, d); break;
+  case 4: xo("f20f5ad0"); xmem("f30f11", 2, b, d); break;
+  }
+}
+
+// runtime appended to the translated code: system calls mapped onto linux (a trap takes its number in eax and
+// a, b and c in edi, esi and edx), memcmp, memchr, and the math on the x87
+char xrun[] =
+  "83f82177104c8d1dd4020000496304834c01d8ffe0b8ffffffffc30f05483d01f0ffff720748c7c0ffffffff89c0c3b839000000ebe5b8e70000000f0548c7c7"
+  "ffffffff31f631d24531d2b83d000000ebc9b816000000ebc2b801000000ebbb31c00f054883f8eb75b381fa0001000075a34989fc4989f54881ec0002000048"
+  "89e6ba00020000b8d90000000f054885c07e4e8b042485c07502ffc041894500488d742413498d7d04bafb0000008a06880748ffc648ffc784c07407ffca75ee"
+  "c607004c89e7488b74240831d2b8080000000f054881c400020000b800010000c34881c40002000031c0c3b803000000e926ffffffbe09000000b83e000000e9"
+  "17ffffff89f281e603020000f7c200010000740383ce40baff010000b802000000e9f5feffffb857000000e9ebfeffff4989f44881ec900000004889e6b80500"
+  "00000f054885c075368b142466418914248b5424186641895424028b54240841895424048b54241041895424088b542430418954240c8b542458418954241048"
+  "81c490000000e992feffffb856000000e986feffffbeff010000b853000000e977feffffb850000000e96dfeffffb821000000e963feffffb827000000e959fe"
+  "ffff4c8b05070100004d85c075485731ffbe00000020ba0300000041ba6240000049c7c0ffffffff4531c9b8090000000f055f483d01f0ffff0f8316feffff49"
+  "89c0488905c7000000480500000020488905c20000004863ff4d8d0c384c3b0db40000000f87ebfdffff4c890d9f0000004489c0c34863f6b808000000e9d9fd"
+  "ffff4989d231d2b828000000e9cafdffff4989fc418b3c24418b742408ba0300000041ba6200000049c7c0ffffffff4531c9b8090000000f05483d01f0ffff0f"
+  "8398fdffff41f6442418200f858cfdffff4989c5418b7c24204c89ee418b542408458b542428b8110000000f05483d01f0ffff0f8364fdffff4c89e8e95cfdff"
+  "ffb80b000000e950fdffff0f1f4400000000000000000000000000000000000035fdffff4ffdffff56fdffff5dfdffff72fdffff79fdffff80fdffff0bfeffff"
+  "15feffff35fdffff24feffff35fdffff46feffff50feffffabfeffffb5feffffc4feffffcefeffffd8feffffe2feffff35fdffff35fdffff55ffffff35fdffff"
+  "35fdffff35fdffff35fdffff35fdffff35fdffff35fdffff35fdffff62ffffff71ffffffe1ffffff89c731d285db74140fb6170fb631ffc7ffc1ffcb29f274ec"
+  "01d931db89d0c389c789c889ce89da89d985c9740cf2ae75088d47ff31db89f1c331c089d389f1c3660f57d2660f2ec27516660f2eca750f48ba000000000000"
+  "f03f66480f6ec2c34883ec08f20f110c24dd0424f20f110424dd0424d9e1d9f1e84c000000660f2e14247628f2480f2cd1f6c201741ef2480f2ad2660f2ed175"
+  "1348ba000000000000008066480f6ed2660f57c24883c408c34883ec08f20f110424d9eadc0c24e8050000004883c408c3d9c0d9fcdce9d9c9d9f0d9e8dec1d9"
+  "fdddd94883ec08dd1c24f20f1004244883c408c3d9edeb02d9ece84f010000d9f1e959010000e843010000d9fee94d010000e837010000d9ffe941010000e82b"
+  "010000d9f2ddd8e933010000e81d010000d9e8d9f3e925010000e80f0100004883ec08f20f110c24dd04244883c408d9f3e909010000e8f3000000e81a000000"
+  "d9f3e9f8000000e8e2000000e809000000d9c9d9f3e9e5000000d9c0d8c8d9e8dee1d9fac389c24883ec08f20f110c24dd0424f20f110424dd04244883c408d9"
+  "f8dfe0f6c40475f7ddd989d0e9ae000000ba00040000eb05ba00080000e88c0000004883ec08d93c24668b342466812424fff366091424d92c24d9fc66893424"
+  "d92c244883c408eb76e8cbfeffffe847000000f20f5cc2eb0ee8bbfeffffe837000000f20f58c248ba000000000000e03f66480f6ed2f20f59c2c3e899feffff"
+  "e815000000660f28d8f20f5cdaf20f58c2f20f5ed8660f28c3c348ba000000000000f03f66480f6ed2f20f5ed0c34883ec08f20f110424dd04244883c408c348"
+  "83ec08dd1c24f20f1004244883c408c3";
+enum { X_RUN = 1488, X_MCMP = 0x368, X_MCHR = 0x387 };
+int xmath[] = { 0x3a8, 0x49a, 0, 0x48c, 0x454, 0x458, 0x419, 0x511, 0x518, 0, 0x466, 0x472, 0x47e, 0x4b6, 0x4c7, // POW .. ACOS
+  0x549, 0x559, 0x57b, 0, 0x4e5 };
+
+void xcall(int r) { xo("e8"); xrel(xrt + r); }
+
+int xaddr(int t, int text) { return (t < text) ? X_BASE + X_HDR + xmap[t / 4] : xd + t - text; } // of text offset t
+
+void xlate(int *code, int n, int text)
+{
+  int i, op, imm, t, ntab; double d;
+
+  for (ntab = i = 0; i < n; i++) {
+    xmap[i] = xp;
+    op = code[i] & 0xff; imm = code[i] >> 8;
+    t = (i + 1) * 4 + imm; // pc relative target
+    switch (op) {
+    case ENT:  xo("4881c4"); xw(imm); break;
+    case LEV:  xo("4881c4"); xw(imm); xo("c3"); break;
+    case JMP:  xo("e9"); xrel(xmap[t/4]); break;
+    case JMPI: xo("8b1485"); xw(xtab + ntab * 4); xo("ffe2"); ntab += ((int *)(gs + t - text))[-1]; break;
+    case JSR:  xo("e8"); xrel(xmap[t/4]); break;
+    case JSRA: xo("ffd0"); break;
+    case LEA:  xmem("8d", 0, 4, imm); break;
+    case LEAG: xo("b8"); xw(xaddr(t, text)); break;
+    case CYC:  xo("0f31"); break;
+    case MCPY: xo("89c7 89ce 89d9 f3a4 89f8 89f1 31db"); break;
+    case MSET: xo("89c7 89c8 89ce 89d9 f3aa 89f8 89f1 31db"); break;
+    case MCMP: xcall(X_MCMP); break;
+    case MCHR: xcall(X_MCHR); break;
+
+    case LL ... LLF:   xmem(xld + (op - LL) * 7,  0, 4, imm); break;
+    case LG ... LGF:   xmem(xld + (op - LG) * 7,  0, -1, xaddr(t, text)); break;
+    case LX ... LXF:   xmem(xld + (op - LX) * 7,  0, 0, imm); break;
+    case LBL ... LBLF: xmem(xld + (op - LBL) * 7, 1, 4, imm); break;
+    case LBG ... LBGF: xmem(xld + (op - LBG) * 7, 1, -1, xaddr(t, text)); break;
+    case LBX ... LBXF: xmem(xld + (op - LBX) * 7, 1, 1, imm); break;
+    case LCL:  xmem("8b", 3, 4, imm); break;
+    case LI:   xo("b8"); xw(imm); break;
+    case LBI:  xo("b9"); xw(imm); break;
+    case LHI:  xo("c1e018 0d"); xw((uint)code[i] >> 8); break;
+    case LBHI: xo("c1e118 81c9"); xw((uint)code[i] >> 8); break;
+    case LIF:
+    case LBIF: d = imm / 256.0; xo("48ba"); xw(((int *)&d)[0]); xw(((int *)&d)[1]); xo(op == LIF ? "66480f6ec2" : "66480f6eca"); break;
+    case LBA:  xo("89c1"); break;
+    case LCA:  xo("89c3"); break;
+    case LBAD: xo("660f28c8"); break;
+
+    case SL ... SLF: xst(op - SL, 4, imm); break;
+    case SG ... SGF: xst(op - SG, -1, xaddr(t, text)); break;
+    case SX ... SXF: xst(op - SX, 1, imm); break;
+
+    case ADDF: xo("f20f58c1"); break;
+    case SUBF: xo("f20f5cc1"); break;
+    case MULF: xo("f20f59c1"); break;
+    case DIVF: xo("f20f5ec1"); break;
+    case ADD:  xo("01c8"); break;
+    case ADDI: xo("05"); xw(imm); break;
+    case ADDL: xmem("03", 0, 4, imm); break;
+    case SUB:  xo("29c8"); break;
+    case SUBI: xo("2d"); xw(imm); break;
+    case SUBL: xmem("2b", 0, 4, imm); break;
+    case MUL:  xo("0fafc1"); break;
+    case MULI: xo("69c0"); xw(imm); break;
+    case MULL: xmem("0faf", 0, 4, imm); break;
+    case DIV:  xo("99f7f9"); break;
+    case DIVI: xo("be"); xw(imm); xo("99f7fe"); break;
+    case DIVL: xo("99"); xmem("f7", 7, 4, imm); break;
+    case DVU:  xo("31d2f7f1"); break;
+    case DVUI: xo("be"); xw(imm); xo("31d2f7f6"); break;
+    case DVUL: xo("31d2"); xmem("f7", 6, 4, imm); break;
+    case MOD:  xo("99f7f9 89d0"); break;
+    case MODI: xo("be"); xw(imm); xo("99f7fe 89d0"); break;
+    case MODL: xo("99"); xmem("f7", 7, 4, imm); xo("89d0"); break;
+    case MDU:  xo("31d2f7f1 89d0"); break;
+    case MDUI: xo("be"); xw(imm); xo("31d2f7f6 89d0"); break;
+    case MDUL: xo("31d2"); xmem("f7", 6, 4, imm); xo("89d0"); break;
+    case AND:  xo("21c8"); break;
+    case ANDI: xo("25"); xw(imm); break;
+    case ANDL: xmem("23", 0, 4, imm); break;
+    case OR:   xo("09c8"); break;
+    case ORI:  xo("0d"); xw(imm); break;
+    case ORL:  xmem("0b", 0, 4, imm); break;
+    case XOR:  xo("31c8"); break;
+    case XORI: xo("35"); xw(imm); break;
+    case XORL: xmem("33", 0, 4, imm); break;
+    case SHL:  xo("d3e0"); break;
+    case SHLI: xo("c1e0"); xs[xp++] = imm; break;
+    case SHLL: xo("89ce"); xmem("8b", 1, 4, imm); xo("d3e0 89f1"); break; // the count goes in cl
+    case SHR:  xo("d3f8"); break;
+    case SHRI: xo("c1f8"); xs[xp++] = imm; break;
+    case SHRL: xo("89ce"); xmem("8b", 1, 4, imm); xo("d3f8 89f1"); break;
+    case SRU:  xo("d3e8"); break;
+    case SRUI: xo("c1e8"); xs[xp++] = imm; break;
+    case SRUL: xo("89ce"); xmem("8b", 1, 4, imm); xo("d3e8 89f1"); break;
+
+    case EQ:   xo("39c8 0f94c0 0fb6c0"); break;
+    case NE:   xo("39c8 0f95c0 0fb6c0"); break;
+    case LT:   xo("39c8 0f9cc0 0fb6c0"); break;
+    case LTU:  xo("39c8 0f92c0 0fb6c0"); break;
+    case GE:   xo("39c8 0f9dc0 0fb6c0"); break;
+    case GEU:  xo("39c8 0f93c0 0fb6c0"); break;
+    case EQF:  xo("660f2ec1 0f94c0 0f9bc2 20d0 0fb6c0"); break; // equal and ordered
+    case NEF:  xo("660f2ec1 0f95c0 0f9ac2 08d0 0fb6c0"); break;
+    case LTF:  xo("660f2ec8 0f97c0 0fb6c0"); break;
+    case GEF:  xo("660f2ec1 0f93c0 0fb6c0"); break;
+
+    case BZ:   xo("85c0 0f84"); xrel(xmap[t/4]); break;
+    case BNZ:  xo("85c0 0f85"); xrel(xmap[t/4]); break;
+    case BE:   xo("39c8 0f84"); xrel(xmap[t/4]); break;
+    case BNE:  xo("39c8 0f85"); xrel(xmap[t/4]); break;
+    case BLT:  xo("39c8 0f8c"); xrel(xmap[t/4]); break;
+    case BLTU: xo("39c8 0f82"); xrel(xmap[t/4]); break;
+    case BGE:  xo("39c8 0f8d"); xrel(xmap[t/4]); break;
+    case BGEU: xo("39c8 0f83"); xrel(xmap[t/4]); break;
+    case BZF:  xo("660f57d2 660f2ec2 7a06 0f84"); xrel(xmap[t/4]); break;
+    case BNZF: xo("660f57d2 660f2ec2 0f8a"); xrel(xmap[t/4]); xo("0f85"); xrel(xmap[t/4]); break;
+    case BEF:  xo("660f2ec1 7a06 0f84"); xrel(xmap[t/4]); break;
+    case BNEF: xo("660f2ec1 0f8a"); xrel(xmap[t/4]); xo("0f85"); xrel(xmap[t/4]); break;
+    case BLTF: xo("660f2ec8 0f87"); xrel(xmap[t/4]); break;
+    case BGEF: xo("660f2ec1 0f83"); xrel(xmap[t/4]); break;
+
+    case CID:  xo("f20f2ac0"); break;
+    case CUD:  xo("f2480f2ac0"); break;
+    case CDI:  xo("f20f2cc0"); break;
+    case CDU:  xo("f2480f2cc0 89c0"); break;
+
+    case PSHA: xo("50"); break;
+    case PSHB: xo("51"); break;
+    case PSHC: xo("53"); break;
+    case PSHI: xo("68"); xw(imm); break;
+    case PSHF: xo("4883ec08 f20f110424"); break;
+    case PSHG: xo("4883ec08 f20f110c24"); break;
+    case POPA: xo("58 89c0"); break; // the upper half of the slot may be stale
+    case POPB: xo("59 89c9"); break;
+    case POPC: xo("5b 89db"); break;
+    case POPF: xo("f20f100424 4883c408"); break;
+    case POPG: xo("f20f100c24 4883c408"); break;
+    case SSP:  xo("4889c4"); break;
+    case NOP:  break;
+    case TRAP: xo("51 89c7 89ce 89da b8"); xw(imm); xcall(0); xo("59"); break;
+
+    case FABS: xo("66480f7ec2 480fbaf23f 66480f6ec2"); break;
+    case HYPO: xo("660f28d1 f20f59d2 f20f59c0 f20f58c2 f20f51c0"); break;
+    case SQRT: xo("f20f51c0"); break;
+    default:
+      if (op >= POW && op <= FMOD) xcall(xmath[op - POW]);
+      else xo("0f0b"); // HALT and supervisor instructions
+    }
+  }
+}
+
+// write a native x86-64 linux executable: one segment holding the startup code, the translated text, the
+// runtime and the switch tables, followed by the data, bss, stack and command line
+int xout(char *name, int text, int entry)
+{
+  int i, f, n, pass, size, stack, *code, h[X_HDR/4];
+
+  code = (int *)ts; n = text / 4;
+  xs = memset(new(n * 32 + X_RUN + data + 256), 0, n * 32 + X_RUN + data + 256);
+  xmap = new(n * 4 + 4);
+  for (stack = pass = 0; pass < 2; pass++) { // sizes are known after the first pass, addresses after the second
+    xp = 0;
+    xo("4989e4 498b1c24 41bd"); xw(stack); // copy the arguments below 2G
+    xo("418d7c9d04 4531f6 4939de 731e 4f8b7cf408 43897cb500 418a07 49ffc7 8807 48ffc7 84c0 75f1 49ffc6 ebdd 41c7449d0000000000");
+    xo("48c7c4"); xw(stack); xo("4155 53 e8"); xrel(xmap[entry/4]); // main(argc, argv)
+    xo("89c7 b8e7000000 0f05"); // exit
+    xlate(code, n, text);
+    xrt = xp; xo(xrun);
+    xtab = X_BASE + X_HDR + xp;
+    for (i = 0; i < n; i++)
+      if ((code[i] & 0xff) == JMPI)
+        for (f = (i + 1) * 4 + (code[i] >> 8) - text, size = ((int *)(gs + f))[-1]; size--; f += 4)
+          xw(xaddr((i + 1) * 4 + *(int *)(gs + f), text));
+    size = (X_HDR + xp + 7) & -8;
+    xd = X_BASE + size;
+    stack = (xd + data + bss + X_STACK + 15) & -16;
+  }
+
+  memset(h, 0, X_HDR);
+  h[0] = 0x464c457f; h[1] = 0x00010102; // ELF, 64 bit, little-endian
+  h[4] = 0x003e0002; h[5] = 1;          // executable, x86-64
+  h[6] = X_BASE + X_HDR;                // entry
+  h[8] = 64;                            // program header offset
+  h[13] = 56 << 16 | 64; h[14] = 64 << 16 | 1;
+  h[16] = 1; h[17] = 7;                 // loadable, read write execute
+  h[20] = h[22] = X_BASE;               // address
+  h[24] = size + data;                  // file size
+  h[26] = stack + X_ARGS - X_BASE;      // memory size
+  h[28] = 0x1000;
+  if ((f = open(name, O_WRONLY | O_CREAT | O_TRUNC)) < 0) return -1;
+  write(f, h, X_HDR);
+  write(f, xs, size - X_HDR);
+  write(f, (void *)gs, data);
+  close(f);
+  if (verbose) dprintf(2,"%s : native text %d -> %d\n", cmd, text, xp);
+  return 0;
+}
+
+// length of the identifier at s
+int namelen(char *s)
+{
+  char *p;
+  for (p = s; cid[*(uchar *)p]; p++) ;
+  return p - s;
+}
+
+// add a stub body for each function called but not defined, for ld to send the calls elsewhere
+void imports(void)
+{
+  ident_t *v, **d;
+  for (d = defs; d < pdef; d++)
+    if ((v = *d)->class == FFun && v->val) { *pbody++ = ip; patch(v->val, ip); em(HALT); *pbody++ = ip; v->val = ts + ip - 4; }
+}
+
+// list the symbols for ld.  functions are listed by body index until peep() is done moving them
+int symbols(int *pb, sym_t **psym, char **pstr, int *nstr)
+{
+  int i, n, k; ident_t *v, **d; sym_t *s; char *p;
+
+  for (n = k = 0, d = defs; d < pdef; d++)
+    if ((((v = *d)->class == Fun || v->class == FFun) && v->val) || v->class == Static || v->class == Leag) { n++; k += namelen(v->name) + 1; }
+  for (i = 0; i < nneed; i++) { n++; k += strlen(need[i]) + 1; }
+  *psym = s = new(n * sizeof(sym_t));
+  *pstr = p = memset(new(k + 8), 0, k + 8);
+  *nstr = k;
+  for (d = defs; d < pdef; d++) {
+    switch ((v = *d)->class) {
+    case Fun:    if (!v->val) continue; k = OBJ_FUN; break;
+    case FFun:   if (!v->val) continue; k = OBJ_EXT; break;
+    case Static:
+    case Leag:   k = OBJ_GLO; break;
+    default:     continue;
+    }
+    s->name = p - *pstr;
+    memcpy(p, v->name, n = namelen(v->name)); p += n + 1;
+    s->kind = k | (v->lib ? OBJ_WEAK : 0);
+    s->val = (k == OBJ_GLO) ? v->val : body(pb, (pbody - pb) / 2, v->val - ts);
+    s->size = (k == OBJ_GLO) ? tsize(v->type) : 0;
+    s++;
+  }
+  for (i = 0; i < nneed; i++) {
+    s->name = p - *pstr;
+    memcpy(p, need[i], n = strlen(need[i])); p += n + 1;
+    s->kind = OBJ_NEED; s->val = s->size = 0;
+    s++;
+  }
+  return s - *psym;
+}
+
+// write a relocatable object: the text and data with their patch lists and symbols
+int objout(char *name, int text, sym_t *sym, int nsym, char *str, int nstr, int *patchdata, int *patchbss, int *patchfun, int *patchbody)
+{
+  int i; obj_t h;
+  for (i = 0; i < nsym; i++) if ((sym[i].kind & 7) == OBJ_FUN || sym[i].kind == OBJ_EXT) sym[i].val = patchbody[sym[i].val * 2];
+  if ((i = open(name, O_WRONLY | O_CREAT | O_TRUNC)) < 0) return -1;
+  h.magic  = OBJ_MAGIC;
+  h.text   = text;
+  h.data   = data;
+  h.bss    = bss;
+  h.npdata = pdata - patchdata;
+  h.npbss  = pbss - patchbss;
+  h.npfun  = pfun - patchfun;
+  h.npbody = pbody - patchbody;
+  h.nsym   = nsym;
+  h.nstr   = (nstr + 7) & -8;
+  write(i, &h, sizeof(h));
+  write(i, (void *)ts, text);
+  write(i, (void *)gs, data);
+  write(i, patchdata, h.npdata * sizeof(int));
+  write(i, patchbss, h.npbss * sizeof(int));
+  write(i, patchfun, h.npfun * sizeof(int));
+  write(i, patchbody, h.npbody * sizeof(int));
+  write(i, sym, nsym * sizeof(sym_t));
+  write(i, str, h.nstr);
+  close(i);
+  return 0;
+}
+
+// save the binary and the files it was built from in the cache
+void store(int text, int entry)
+{
+  int i, f; char name[PATH_MAX];
+  dep(cmd, -1); // a new compiler invalidates everything
+  if (!cache) return;
+  mkdir(cache);
+  if (output(cachename(name, ".x"), text, entry) || (f = open(cachename(name, ".d"), O_WRONLY | O_CREAT | O_TRUNC)) < 0) return;
+  write(f, okey, strlen(okey) + 1);
+  for (i = 0; i < ndep; i++) {
+    write(f, &dstat[i], sizeof(struct stat));
+    write(f, dname[i], strlen(dname[i]) + 1);
+  }
+  close(f);
+}
+
+void *vmove(void *p, long d) { return p ? (void *)((long)p + d) : 0; }
+
+// relocate a pointer into header text
+char *hmove(char *s, char **ob, char **nb, int *sz, int n)
+{
+  while (n--) if (s >= ob[n] && s <= ob[n] + sz[n]) return nb[n] + (s - ob[n]);
+  return s;
+}
+
+// restore the state left by a header if it was built from the same files as are there now
+int pchload(char *name, char *key, int n, int *patchdata, int *patchbss, int *patchfun, int *patchbody)
+{
+  int f, i, sz[DEP_SZ]; char *p, *e, *t, *ob[DEP_SZ], *nb[DEP_SZ]; long d; pch_t h; struct stat st;
+  ident_t **hp, *v; struct_t *s; member_t *m;
+
+  if ((f = open(name, O_RDONLY)) < 0) return 0;
+  if (fstat(f, &st) || st.st_size < sizeof(h) || read(f, p = new(st.st_size), st.st_size) != st.st_size) { close(f); return 0; }
+  close(f);
+  e = p + st.st_size;
+  memcpy(&h, p, sizeof(h)); p += sizeof(h);
+  if (h.magic != PCH_MAGIC || h.key != n || e - p < n || h.hmask < HASH_SZ - 1 || (h.hmask & (h.hmask + 1)) || h.nhdr < 0 || h.nhdr > DEP_SZ ||
+      h.ndep < 0 || ndep + h.ndep > DEP_SZ || memcmp(p, key, n)) return 0;
+  for (p += n, i = ndep; i < ndep + h.ndep; i++, p += strlen(p) + 1) { // every length is checked before it is used: the file may be short
+    if (e - p <= sizeof(st)) return 0;
+    memcpy(&dstat[i], p, sizeof(st));
+    p += sizeof(st);
+    if (!memchr(p, 0, e - p) || stat(p, &st) || st.st_ino != dstat[i].st_ino || st.st_gen != dstat[i].st_gen || st.st_size != dstat[i].st_size) return 0;
+    dname[i] = p;
+  }
+  if (e - p < (h.hmask + 1) * sizeof(ident_t *) + sizeof(structs) + h.nhdr * (sizeof(char *) + sizeof(int))) return 0;
+  t = p; p += (h.hmask + 1) * sizeof(ident_t *);
+  memcpy(&structs, p, sizeof(structs)); p += sizeof(structs);
+  memcpy(ob, p, h.nhdr * sizeof(char *)); p += h.nhdr * sizeof(char *);
+  memcpy(sz, p, h.nhdr * sizeof(int)); p += h.nhdr * sizeof(int);
+  for (i = 0; i < h.nhdr; i++) { if (sz[i] < 0 || e - p <= sz[i]) return 0; nb[i] = p; p += sz[i] + 1; }
+  if (e - p != h.pool + h.text + h.data + (h.npdata + h.npbss + h.npfun + h.npbody) * sizeof(int)) return 0; // short or stale file
+  ndep += h.ndep;
+
+  if (h.hmask != hmask) { ht = 0; rehash(h.hmask); }
+  memcpy(ht, t, (h.hmask + 1) * sizeof(ident_t *));
+  memcpy((void *)va, p, h.pool); p += h.pool; vp = va + h.pool;
+  memcpy((void *)ts, p, ip = h.text); p += ip;
+  memcpy((void *)gs, p, data = h.data); p += data;
+  memcpy(patchdata, p, h.npdata * sizeof(int)); p += h.npdata * sizeof(int); pdata = patchdata + h.npdata;
+  memcpy(patchbss, p, h.npbss * sizeof(int)); p += h.npbss * sizeof(int); pbss = patchbss + h.npbss;
+  memcpy(patchfun, p, h.npfun * sizeof(int)); p += h.npfun * sizeof(int); pfun = patchfun + h.npfun;
+  memcpy(patchbody, p, h.npbody * sizeof(int)); pbody = patchbody + h.npbody;
+  bss = h.bss;
+  ffun = h.ffun;
+
+  // relocate the symbol tables to the new pool, text segment and header text
+  d = va - h.va;
+  for (nid = i = 0; i <= hmask; i++) {
+    for (hp = &ht[i]; *hp; hp = &v->next, nid++) {
+      v = *hp = vmove(*hp, d);
+      v->name = hmove(v->name, ob, nb, sz, h.nhdr);
+      if (v->macro) v->macro = hmove(v->macro, ob, nb, sz, h.nhdr);
+      if (v->class == Fun) v->val += ts - h.ts;
+      if (v->inl) ((inline_t *)(va + v->inl))->body = hmove(((inline_t *)(va + v->inl))->body, ob, nb, sz, h.nhdr);
+    }
+  }
+  for (s = structs = vmove(structs, d); s; s = s->next) {
+    s->id = vmove(s->id, d);
+    s->next = vmove(s->next, d);
+    for (m = s->member = vmove(s->member, d); m; m = m->next) {
+      m->id = vmove(m->id, d);
+      m->next = vmove(m->next, d);
+    }
+  }
+  return 1;
+}
+
+char *put(char *q, void *s, int n) { memcpy(q, s, n); return q + n; }
+
+// save the state left by the leading #include lines.  the file is written with a single write, so a compile
+// reading it while another one saves it sees all of it or too little
+void pchsave(char *name, char *key, int n, int d, int *patchdata, int *patchbss, int *patchfun, int *patchbody)
+{
+  int f, i, m; char *b, *q; pch_t h;
+
+  i = ndep;
+  dep(cmd, -1); // a new compiler invalidates the snapshot
+  if (!cache || ndep == i || nhdr == DEP_SZ) return;
+  h.magic = PCH_MAGIC;
+  h.key = n;
+  h.ndep = ndep - d;
+  h.nhdr = nhdr;
+  h.pool = vp - va;
+  h.text = ip;
+  h.data = data;
+  h.bss = bss;
+  h.npdata = pdata - patchdata;
+  h.npbss = pbss - patchbss;
+  h.npfun = pfun - patchfun;
+  h.npbody = pbody - patchbody;
+  h.ffun = ffun;
+  h.va = va;
+  h.ts = ts;
+  h.hmask = hmask;
+  m = sizeof(h) + n + (hmask + 1) * sizeof(ident_t *) + sizeof(structs) + nhdr * (sizeof(char *) + sizeof(int)) +
+      h.pool + ip + data + (h.npdata + h.npbss + h.npfun + h.npbody) * sizeof(int);
+  for (i = d; i < ndep; i++) m += sizeof(struct stat) + strlen(dname[i]) + 1;
+  for (i = 0; i < nhdr; i++) m += hsize[i] + 1;
+  q = b = new(m);
+  q = put(q, &h, sizeof(h));
+  q = put(q, key, n);
+  for (i = d; i < ndep; i++) {
+    q = put(q, &dstat[i], sizeof(struct stat));
+    q = put(q, dname[i], strlen(dname[i]) + 1);
+  }
+  q = put(q, ht, (hmask + 1) * sizeof(ident_t *));
+  q = put(q, &structs, sizeof(structs));
+  q = put(q, hbase, nhdr * sizeof(char *));
+  q = put(q, hsize, nhdr * sizeof(int));
+  for (i = 0; i < nhdr; i++) q = put(q, hbase[i], hsize[i] + 1); // with the terminating zero
+  q = put(q, (void *)va, h.pool);
+  q = put(q, (void *)ts, ip);
+  q = put(q, (void *)gs, data);
+  q = put(q, patchdata, h.npdata * sizeof(int));
+  q = put(q, patchbss, h.npbss * sizeof(int));
+  q = put(q, patchfun, h.npfun * sizeof(int));
+  q = put(q, patchbody, h.npbody * sizeof(int));
+  if ((f = open(name, O_WRONLY | O_CREAT | O_TRUNC)) < 0) return;
+  write(f, b, m);
+  close(f);
+}
+
+// compile the leading #include lines, or restore their state from a precompiled header
+void header(int *patchdata, int *patchbss, int *patchfun, int *patchbody)
+{
+  int i, n, d; uint h; char *p, *q, *s, *key, name[PATH_MAX];
+
+  for (p = q = pos; ; ) { // find the end of the last leading #include line
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p == '/' && p[1] == '/') while (*p && *p != '\n') p++;
+    else if (*p == '/' && p[1] == '*') { for (p += 2; *p && (*p != '*' || p[1] != '/'); p++); if (*p) p += 2; }
+    else if (*p == '#' && !memcmp(p + 1, "include", 7)) { while (*p && *p != '\n') p++; q = p; }
+    else break;
+  }
+  if (q == pos) return;
+
+  // the snapshot depends on the options, the lines and where the include files are looked for
+  if (incl) { s = incl; i = strlen(incl); }
+  else { s = file; for (i = strlen(file); i && file[i-1] != '/'; i--); }
+  d = strlen(okey) + 1;
+  key = new(d + i + (q - pos) + 1);
+  memcpy(key, okey, d);
+  memcpy(key + d, s, i);
+  key[d + i] = '\n';
+  memcpy(key + d + i + 1, pos, q - pos);
+  n = d + i + 1 + (q - pos);
+  for (h = i = 0; i < n; i++) h = h * 147 + key[i];
+  sprintf(name, "%s/%08x.pch", cache, h);
+
+  if (pchload(name, key, n, patchdata, patchbss, patchfun, patchbody)) {
+    if (verbose) dprintf(2,"%s : restored %s\n", cmd, name);
+    for (; pos < q; pos++) if (*pos == '\n') line++;
+    return;
+  }
+
+  // compile a terminated copy of the lines
+  d = ndep;
+  s = memcpy(new(q - pos + 1), p = pos, q - pos);
+  s[q - pos] = 0;
+  pos = s;
+  next();
+  decl(Static);
+  pos = p + (pos - s);
+  if (!errs) {
+    mkdir(cache);
+    pchsave(name, key, n, d, patchdata, patchbss, patchfun, patchbody);
+  }
+}
+
 int main(int argc, char *argv[])
 {
-  int i, text, *patchdata, *patchbss; long amain, sbrk_start;
-  ident_t *tmain;
-  char *outfile;
-  struct { uint magic, bss, entry, flags; } hdr;
+  int i, xs, text, hip, nsym, nstr, *patchdata, *patchbss, *patchfun, *patchbody; long amain, sbrk_start;
+  ident_t *tmain, *tstart;
+  sym_t *sym;
+  char *outfile, *str, *src, *stk;
   struct stat st;
 
   cmd = *argv;
+  iret = -1;
   if (argc < 2) goto usage;
   outfile = 0;
   file = *++argv;
@@ -2223,40 +3989,78 @@ int main(int argc, char *argv[])
     switch (file[1]) {
     case 'v': verbose = 1; break;
     case 's': debug = 1; break;
+    case 'c': object = file; break;
+    case 'x': native = 1; break;
+    case 'O': optimize = file[2] ? atoi(file + 2) : INLINE_SZ; peephole = 1; break;
     case 'I': incl = file + 2; break;
+    case 'C': cache = file + 2; break;
+    case 'P': profile = file + 2; break;
     case 'o': if (argc > 1) { outfile = *++argv; argc--; break; }
-    default: usage: dprintf(2,"usage: %s [-v] [-s] [-Ipath] [-o exefile] file ...\n", cmd); return -1;
+    default: usage: dprintf(2,"usage: %s [-v] [-s] [-c] [-x] [-O[size]] [-Ipath] [-Cpath] [-Pprofile] [-o exefile] file ...\n", cmd); return -1;
     }
     file = *++argv;
   }
+  if (native && (object || !outfile)) { dprintf(2,"%s : -x needs -o and no -c\n", cmd); return -1; }
+  if (profile && object) { dprintf(2,"%s : -P needs no -c\n", cmd); return -1; }
+  if (debug || object) cache = 0;
+  if (object) {
+    if (!outfile) { // file.c -> file.o
+      outfile = strcpy(new((i = strlen(file)) + 3), file);
+      if (i > 2 && file[i-2] == '.') outfile[i-1] = 'o'; else strcpy(outfile + i, ".o");
+    }
+    object = outfile;
+  }
+  sprintf(okey, "%d %d %s", peephole, optimize, profile ? profile : "");
+  if (cache && !outfile) cached(argv);
 
   sbrk_start = (long) sbrk(0);
-  ts =      (long) new(SEG_SZ); ip = 0;
-  gs      = (long) new(SEG_SZ);
-  va = vp = (long) new(VAR_SZ);
+  ts =      (long) arena(SEG_SZ); ip = 0;
+  gs      = (long) arena(SEG_SZ);
+  va = vp = (long) arena(VAR_SZ);
+  rehash(HASH_SZ - 1);
+  for (i = '0'; i <= 'z'; i++) cid[i] = (i >= 'a' || (i >= 'A' && i <= 'Z') || i <= '9' || i == '_');
+  cid['$'] = 1;
 
   bigend = 1; bigend = ((char *)&bigend)[3];
 
-  pos = "asm auto break case char continue default do double else enum float for goto if int long return short "
-        "sizeof static struct switch typedef union unsigned void while va_list va_start va_arg main";
+  hbase[nhdr] = pos = "asm auto break case char continue default do double else enum float for goto if int long return short "
+        "sizeof static struct switch typedef union unsigned void while va_list va_start va_arg main xstart";
+  hsize[nhdr++] = strlen(pos);
   for (i = Asm; i <= Va_arg; i++) { next(); id->tk = i; }
   next();
   tmain = id;
+  next();
+  tstart = id;
 
   line = 1;
   if (stat(file, &st)) { dprintf(2,"%s : [%s:%d] error: can't stat file %s\n", cmd, file, line, file); return -1; } // XXX fstat inside mapfile?
-  pos = mapfile(file, st.st_size);
+  src = pos = st.st_size > WIN_SZ ? openwin(file) : mapfile(file, st.st_size);
 
-  e = new(EXPR_SZ) + EXPR_SZ;
-  pdata = patchdata = new(PSTACK_SZ);
-  pbss  = patchbss  = new(PSTACK_SZ);
-  ploc  =             new(LSTACK_SZ);
+  stk = arena(STK_SZ); // the stacks share a mapping
+  e = (N)(stk + EXPR_SZ);
+  pdata = patchdata = (int *)(stk + EXPR_SZ);
+  pbss  = patchbss  = (int *)(stk + EXPR_SZ + PSTACK_SZ);
+  pfun  = patchfun  = (int *)(stk + EXPR_SZ + PSTACK_SZ * 2);
+  pbody = patchbody = (int *)(stk + EXPR_SZ + PSTACK_SZ * 3);
+  ploc  =         (loc_t *)(stk + EXPR_SZ + PSTACK_SZ * 4);
+  if (object) pdef = defs = arena(VAR_SZ / sizeof(ident_t) * sizeof(ident_t *));
 
   if (verbose) dprintf(2,"%s : compiling %s\n", cmd, file);
   if (debug) dline();
+  if (cache) header(patchdata, patchbss, patchfun, patchbody);
   next();
   decl(Static);
-  if (!errs && ffun) err("unresolved forward function (retry with -v)");
+  if (!errs && ffun && !object) err("unresolved forward function (retry with -v)");
+  if (verbose && optimize) dprintf(2,"%s : %d tail calls\n", cmd, ntail);
+
+  if (!(amain = tmain->val) && !object) err("main() not defined");
+  if (amain && (xs = tstart->class == Fun)) amain = tstart->val; // libc.h xstart() calls main and exits through exit()
+  if (!errs && !debug && object) imports();
+  hip = ip;
+  if (!errs && !debug) ip = prune(patchbody, patchfun, patchdata, patchbss, &amain);
+  if (!errs && !debug && object) { nsym = symbols(patchbody, &sym, &str, &nstr); if (!amain) amain = ts; }
+  if (!errs && !debug && peephole) ip = peep(patchbody, patchfun, patchdata, patchbss, &amain);
+  if (!errs && !debug && profile) ip = layout(patchbody, patchfun, patchdata, patchbss, &amain);
 
   ip = (ip + 7) & -8;
   text = ip;
@@ -2264,31 +4068,30 @@ int main(int argc, char *argv[])
   bss = (bss + 7) & -8;
 
   if (text + data + bss > SEG_SZ) err("text + data + bss segment exceeds maximum size");
-  if (!(amain = tmain->val)) err("main() not defined");
 
   if (verbose || errs) dprintf(2,"%s : %s compiled with %d errors\n", cmd, file, errs);
   if (verbose) dprintf(2,"entry = %d text = %d data = %d bss = %d\n", amain - ts, text, data, bss);
 
-  if (!errs && !debug) {
+  if (!errs && !debug && object) {
+    if (objout(outfile, text, sym, nsym, str, nstr, patchdata, patchbss, patchfun, patchbody))
+      { dprintf(2,"%s : error: can't open output file %s\n", cmd, outfile); return -1; }
+  } else if (!errs && !debug) {
     while (pdata != patchdata) { pdata--; *(int *)(ts + *pdata) += (ip        - *pdata - 4) << 8; }
     while (pbss  != patchbss ) { pbss--;  *(int *)(ts + *pbss)  += (ip + data - *pbss  - 4) << 8; }
     if (outfile) {
-      if ((i = open(outfile, O_WRONLY | O_CREAT | O_TRUNC)) < 0)
+      if (native ? xout(outfile, text, amain - ts) : output(outfile, text, amain - ts))
         { dprintf(2,"%s : error: can't open output file %s\n", cmd, outfile); return -1; }
-      hdr.magic = 0xC0DEF00D;
-      hdr.bss   = bss;
-      hdr.entry = amain - ts;
-      hdr.flags = 0;
-      write(i, &hdr, sizeof(hdr));
-      write(i, (void *)ts, text);
-      write(i, (void *)gs, data);
-      close(i);
     } else {
+      if (cache) store(text, amain - ts);
       memcpy((void *)(ts+ip), (void *)gs, data);
-      sbrk(sbrk_start + text + data + 8 - (long)sbrk(0)); // free compiler memory
-      sbrk(bss);
-      if (verbose) dprintf(2,"%s : running %s\n", cmd, file);
-      errs = ((int (*)())amain)(argc, argv);
+      if (hip > text + data) memset((void *)(ts + text + data), 0, hip - text - data < bss ? hip - text - data : bss); // code dropped by -O
+      munmap((void *)gs, SEG_SZ); munmap((void *)va, VAR_SZ); munmap(stk, STK_SZ); // leave mappings for a nested compiler
+      munmap(src, win ? WIN_SZ + 1 : st.st_size + 1);
+      for (i = 1; i < nhdr; i++) munmap(hbase[i], hsize[i] + 1);
+      if (ts >= sbrk_start + 8) sbrk(sbrk_start - (long)sbrk(0)); // free compiler memory, the program runs in place
+      else { sbrk(sbrk_start + text + data + 8 - (long)sbrk(0)); sbrk(bss); } // ts came from sbrk
+      if (verbose) dprintf(2,"%s : running %s%s\n", cmd, file, xs ? ", which exits from its xstart()" : "");
+      errs = ((int (*)())amain)(argc, argv); // a libc.h program leaves through its own exit() and never gets back here
       if (verbose) dprintf(2,"%s : %s main returned %d\n", cmd, file, errs);
     }
   }
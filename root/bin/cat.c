@@ -8,26 +8,26 @@
 
 #include <u.h>
 #include <libc.h>
+#include <file.h>
 
-void cat(int fd)
+void cat(FILE *f)
 {
   char buf[4096]; int n;
-  while ((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (write(1, buf, n) != n) { dprintf(2,"cat: write error\n"); exit(-1); }
-  }
-  if (n < 0) { dprintf(2,"cat: read error\n"); exit(-1); }
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) fwrite(buf, 1, n, stdout);
+  if (ferror(f)) { dprintf(2,"cat: read error\n"); exit(-1); }
+  if (ferror(stdout)) { dprintf(2,"cat: write error\n"); exit(-1); }
 }
 
 int main(int argc, char *argv[])
 {
-  int i, fd;
+  int i; FILE *f;
 
-  if (argc <= 1) { cat(0); return 0; }
+  if (argc <= 1) { cat(stdin); return 0; }
   
   for (i = 1; i < argc; i++) {
-    if ((fd = open(argv[i], O_RDONLY)) < 0) { dprintf(2,"cat: cannot open %s\n", argv[i]); return -1; }
-    cat(fd);
-    close(fd);
+    if (!(f = fopen(argv[i], "r"))) { dprintf(2,"cat: cannot open %s\n", argv[i]); return -1; }
+    cat(f);
+    fclose(f);
   }
   return 0;
 }
@@ -16,9 +16,9 @@ enum {
 };
 
 int col, ind, x, page, pagex = -1, gap, egap, ebuf, line = 1;
-int lines;
+int lines, mapped;
 
-char buf[BUF], *filename;
+char *buf, *filename;
 
 xmemmove(char *d, char *s, uint n) { if (d > s && s + n > d) { while (n--) d[n] = s[n]; } else memcpy(d, s, n); }
 
@@ -109,7 +109,9 @@ display()
 
 save()
 {
-  int i;
+  int i; char c;
+  for (i = 0; i < mapped; i += 4096) c = buf[i]; // fault in the rest of the file before truncating it out from under the mapping
+  mapped = 0;
   if ((i = open(filename, O_WRONLY | O_CREAT | O_TRUNC)) < 0) return; 
   if (gap) write(i, buf, gap);
   if (egap < ebuf) write(i, buf + egap, ebuf - egap);
@@ -118,15 +120,17 @@ save()
 
 int main(int argc, char **argv)
 {
-  int i;
+  int i; struct stat st;
   if (argc < 2) { dprintf(2,"usage:  edit file\n"); exit(-1); }
-  initscr();
-  keypad(1);
   ebuf = egap = BUF;
-  if ((i = open(filename = argv[1], O_RDONLY)) >= 0) {
-    if ((gap = read(i, buf, BUF)) < 0) gap = 0;
+  if ((i = open(filename = argv[1], O_RDONLY)) >= 0) { // edit a private mapping of the file, the tail of the buffer is zero
+    if (fstat(i, &st) || (buf = mmap(0, BUF, PROT_READ | PROT_WRITE, MAP_PRIVATE, i, 0)) == (char *)-1) buf = 0;
+    else mapped = gap = (st.st_size < BUF) ? st.st_size : BUF;
     close(i);
   }
+  if (!buf && (buf = mmap(0, BUF, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) == (char *)-1) { dprintf(2,"edit: out of memory\n"); exit(-1); }
+  initscr();
+  keypad(1);
   
 //  for (gap = 0; (n = read(i, buf + gap, BUF - gap)) > 0; gap += n) ;
 //  for (p = buf; p < buf + gap && (p = memchr(p, '\n', gap - p)); lines++, p++) ;
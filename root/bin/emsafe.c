@@ -16,6 +16,7 @@ enum {
   TB_SZ  =     1024*1024, // page translation buffer array size (4G / pagesize)
   FS_SZ  =   4*1024*1024, // ram file system size (4M)
   TPAGES = 4096,          // maximum cached page translations
+  CYCMS  = 100*1000,      // nominal cycles per millisecond (paces host sleep while idle)
 };
 
 enum {           // page table entry flags
@@ -37,7 +38,8 @@ enum {           // processor fault codes (some can be masked together)
   FIPAGE,        // page fault on opcode fetch
   FWPAGE,        // page fault on write
   FRPAGE,        // page fault on read
-  USER = 16      // user mode exception 
+  USER = 16,     // user mode exception 
+  FNET = 32      // network interrupt
 };
 
 uint verbose,    // chatty option -v
@@ -136,9 +138,50 @@ ulong wlook(uint v)
   return 0;
 }
 
+enum { NARM = 64 }; // XXX
+
+struct pollfd pfds[NARM+1]; // console and armed sockets
+int narm, nready, ready[NARM];
+
+// arm socket sd to raise FNET once it is readable, returns 1 if it already is
+int sockarm(int sd)
+{
+  int i; struct pollfd pfd;
+  pfd.fd = sd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 0) == 1) return 1;
+  for (i = 1; i <= narm; i++) if (pfds[i].fd == sd) return 0;
+  if (narm == NARM) return 1; // XXX full, the kernel falls back to polling
+  pfds[++narm].fd = sd;
+  pfds[narm].events = POLLIN;
+  return 0;
+}
+
+// move armed sockets that polled readable onto the ready list, returns how many
+int sockscan()
+{
+  int i, n;
+  for (i = 1, n = 0; i <= narm; ) {
+    if (!pfds[i].revents) { i++; continue; }
+    if (nready < NARM) ready[nready++] = pfds[i].fd;
+    pfds[i].fd = pfds[narm].fd;
+    pfds[i].revents = pfds[narm--].revents;
+    n++;
+  }
+  return n;
+}
+
+// forget a socket that is being closed
+void sockdisarm(int sd)
+{
+  int i;
+  for (i = 1; i <= narm; i++) if (pfds[i].fd == sd) { pfds[i].fd = pfds[narm--].fd; break; }
+  for (i = 0; i < nready; i++) if (ready[i] == sd) { ready[i] = ready[--nready]; break; }
+}
+
 void cpu(uint pc, uint sp)
 {
-  uint a, b, c, ssp, usp, t, v, u, cycle, timer, timeout, xpc, delta;
+  uint a, b, c, ssp, usp, t, v, u, cycle, timer, timeout, oneshot, xpc, delta;
   ulong p, ppc, tt;
 
   double f, g;
@@ -148,29 +191,31 @@ void cpu(uint pc, uint sp)
   struct sockaddr_in addr;
   static char rbuf[4096]; // XXX
   
-  a = b = c = cycle = timer = timeout = 0;
+  a = b = c = cycle = timer = timeout = oneshot = 0;
   delta = 4096;
   kbchar = -1;
+  pfds[0].events = POLLIN;
   xpc = -1;
 
   for (;;) {
 //    if (sp & 7) { dprintf(2,"stack pointer not a multiple of 8!\n", sp); goto fatal; }
     if (!(++cycle % delta)) { // XXX maybe dont check if last char pending?
-      if (iena || !(ipend & FKEYBD)) { // XXX dont do this, use a small queue instead
-        pfd.fd = 0;
-        pfd.events = POLLIN;
-        if (poll(&pfd, 1, 0) == 1 && read(0, &ch, 1) == 1) {
+      pfds[0].fd = (iena || !(ipend & FKEYBD)) ? 0 : -1; // XXX dont do this, use a small queue instead
+      if (poll(pfds, narm + 1, 0) > 0) {
+        if (sockscan()) ipend |= FNET;
+        if (pfds[0].revents && read(0, &ch, 1) == 1) {
           kbchar = ch;
           if (kbchar == '`') { dprintf(2,"ungraceful exit. cycle = %u\n", cycle); return; }
-          if (iena) { trap = FKEYBD; iena = 0; goto interrupt; }
           ipend |= FKEYBD;
         }
+        if (iena && ipend) { trap = ipend & -ipend; ipend ^= trap; iena = 0; goto interrupt; }
       }
       if (timeout) {
         timer += delta;
         if (timer >= timeout) { // XXX  // any interrupt actually!
 //          dprintf(2,"timeout! timer=%d, timeout=%d\n",timer,timeout);
-          timer = 0;      
+          timer = 0;
+          if (oneshot) timeout = 0;
           if (iena) { trap = FTIMER; iena = 0; goto interrupt; }
           ipend |= FTIMER;
         }
@@ -187,27 +232,25 @@ void cpu(uint pc, uint sp)
     case HALT: if (user || verbose) dprintf(2,"halt(%d) cycle = %u\n", a, cycle); return; // XXX should be supervisor!
     case IDLE: if (user) { trap = FPRIV; break; }
       if (!iena) { trap = FINST; break; } // XXX this will be fatal !!!
-      for (;;) {
-        pfd.fd = 0;
-        pfd.events = POLLIN;
-        if (poll(&pfd, 1, 0) == 1 && read(0, &ch, 1) == 1) {
-          kbchar = ch;
-          if (kbchar == '`') { dprintf(2,"ungraceful exit. cycle = %u\n", cycle); return; }
-          trap = FKEYBD; 
+      for (;;) { // nothing to run, so block on the keyboard and armed sockets until the timer deadline (if any)
+        pfds[0].fd = 0;
+        if (poll(pfds, narm + 1, timeout ? (timer < timeout ? (timeout - timer) / CYCMS : 0) : -1) > 0) {
+          if (sockscan()) ipend |= FNET;
+          if (pfds[0].revents && read(0, &ch, 1) == 1) {
+            kbchar = ch;
+            if (kbchar == '`') { dprintf(2,"ungraceful exit. cycle = %u\n", cycle); return; }
+            ipend |= FKEYBD;
+          }
+          if (ipend) { trap = ipend & -ipend; ipend ^= trap; iena = 0; goto interrupt; }
+        }
+        if (timeout) { // skip ahead to the deadline
+          if (timer < timeout) cycle += timeout - timer;
+          timer = 0;
+          if (oneshot) timeout = 0;
+          trap = FTIMER;
           iena = 0;
           goto interrupt;
         }
-        cycle += delta;
-        if (timeout) {
-          timer += delta;
-          if (timer >= timeout) { // XXX  // any interrupt actually!
-//        dprintf(2,"IDLE timeout! timer=%d, timeout=%d\n",timer,timeout);
-            timer = 0;      
-            trap = FTIMER;
-            iena = 0;
-            goto interrupt;
-          }
-        }
       }
 
     // memory -- designed to be restartable/continuable after exception/interrupt
@@ -519,8 +562,9 @@ void cpu(uint pc, uint sp)
     case SPAG: if (user) { trap = FPRIV; break; } if (a && !pdir) { trap = FMEM; break; } paging = a; flush(); continue; // enable paging
     
     case TIME: if (user) { trap = FPRIV; break; } 
+       if (ir>>8 == 1) { timer = 0; timeout = a; oneshot = 1; ipend &= ~FTIMER; continue; } // one-shot: interrupt once after a cycles (0 cancels)
        if (ir>>8) { dprintf(2,"timer%d=%u timeout=%u\n", ir>>8, timer, timeout); continue; }    // XXX undocumented feature!
-       timeout = a; continue; // XXX cancel pending interrupts if disabled?
+       timeout = a; oneshot = 0; continue; // XXX cancel pending interrupts if disabled?
 
     // XXX need some sort of user mode thread locking functions to support user mode semaphores, etc.  atomic test/set?
     
@@ -533,7 +577,7 @@ void cpu(uint pc, uint sp)
     
     // networking -- XXX HACK CODE (and all wrong), but it gets some basic networking going...
     case NET1: if (user) { trap = FPRIV; break; } a = socket(a, b, c); continue; // XXX
-    case NET2: if (user) { trap = FPRIV; break; } a = close(a); continue; // XXX does this block?
+    case NET2: if (user) { trap = FPRIV; break; } sockdisarm(a); a = close(a); continue; // XXX does this block?
     case NET3: if (user) { trap = FPRIV; break; }
       memset(&addr, 0, sizeof(addr));
       addr.sin_family = b & 0xFFFF;
@@ -563,6 +607,8 @@ void cpu(uint pc, uint sp)
       a = t;
       continue;
     case NET6: if (user) { trap = FPRIV; break; }
+      if (ir>>8 == 1) { a = sockarm(a); continue; } // interrupt with FNET once readable
+      if (ir>>8 == 2) { a = nready ? ready[--nready] : -1; continue; } // next armed socket that became readable
       pfd.fd = a;
       pfd.events = POLLIN;
       a = poll(&pfd, 1, 0); // XXX do something completely different
@@ -579,7 +625,7 @@ void cpu(uint pc, uint sp)
       continue;
     case NET9: if (user) { trap = FPRIV; break; }
       // XXX if ((unknown || !ready) && !poll()) return -1;
-//      a = accept(a, (void *)b, (void *)c); // XXX cant do this with virtual addresses!!!
+      a = accept(a, 0, 0); // XXX cant pass virtual addresses through, but the kernel only uses nulls
       continue;
     
     default: trap = FINST; break;
@@ -1,8 +1,16 @@
 // eu -- user mode cpu emulator
 //
-// Usage:  eu [-v] file ...
+// Usage:  eu [-v] [-p profile] file ...
 //
 // Description:
+//   eu runs an executable with its system calls passed to the host.  Instructions are
+//   dispatched through a table of label addresses, so it builds with gcc or with c.
+//   The host intrinsic traps (S_host and on in u.h) run vsprintf, strcmp, strncmp
+//   and strstr on the host for libc.h, with the same results as its own code.
+//
+//   -v  Verbose output, with the cycle count at exit.
+//   -p  Count how often each conditional branch is taken and not taken, and write the
+//       counts to profile when the program exits, for c -P to lay out its code by.
 //
 // Written by Robert Swierczek
 
@@ -12,15 +20,108 @@
 #include <net.h>
 
 enum { STACKSZ = 8*1024*1024 }; // user stack size (8M)
+enum { PRF_MAGIC = 0xC0DEB4AC };  // branch profile file magic
 
 int verbose;
 char *cmd;
+uint *prof, pbase; // with -p, run and taken counts of each instruction, and the text address
+
+// host intrinsics, each giving exactly what the libc.h code it stands in for would
+int ustrcmp(char *d, char *s) { for (; *d == *s; d++, s++) if (!*d) return 0; return *d - *s; }
+int ustrncmp(char *d, char *s, int n) { while (n > 0) { if (!*d || *d != *s) return *d - *s; n--; d++; s++; } return 0; }
+
+int uvsprintf(char *s, char *f, char *v) // v is the guest va_list, a slot of 8 per argument
+{
+  char *e = s, *p, c, fill, b[1024];
+  int i, left, fmax, fmin, sign, prec;
+  double d;
+
+  while (c = *f++) {
+    if (c != '%') { *e++ = c; continue; }
+    if (*f == '%') { *e++ = *f++; continue; }
+    if (left = (*f == '-')) f++;
+    fill = (*f == '0') ? *f++ : ' ';
+    fmin = sign = 0; fmax = sizeof(b); prec = 6;
+    if (*f == '*') { fmin = *(int *)(v += 8); f++; } else while ('0' <= *f && *f <= '9') fmin = fmin * 10 + *f++ - '0';
+    if (*f == '.') { if (*++f == '*') { fmax = *(int *)(v += 8); f++; } else { for (fmax = 0; '0' <= *f && *f <= '9'; fmax = fmax * 10 + *f++ - '0'); prec = fmax; } }
+    if (*f == 'l') f++;
+    switch (c = *f++) {
+    case 0: *e++ = '%'; *e = 0; return e - s;
+    case 'c': fill = ' '; i = (*(p = b) = *(int *)(v += 8)) ? 1 : 0; break;
+    case 's': fill = ' '; if (!(p = *(char **)(v += 8))) p = "(null)"; if ((i = strlen(p)) > fmax) i = fmax; break;
+    case 'u': i = *(int *)(v += 8); goto c1;
+    case 'd': if ((i = *(int *)(v += 8)) < 0) { sign = 1; i = -i; } c1: p = b + sizeof(b)-1; do { *--p = ((uint)i % 10) + '0'; } while (i = (uint)i / 10); i = (b + sizeof(b)-1) - p; break;
+    case 'o': i = *(int *)(v += 8); p = b + sizeof(b)-1; do { *--p = (i & 7) + '0'; } while (i = (uint)i >> 3); i = (b + sizeof(b)-1) - p; break;
+    case 'p': fill = '0'; fmin = 8; c = 'x';
+    case 'x': case 'X': c -= 33; i = *(int *)(v += 8); p = b + sizeof(b)-1; do { *--p = (i & 15) + ((i & 15) > 9 ? c : '0'); } while (i = (uint)i >> 4); i = (b + sizeof(b)-1) - p; break;
+    case 'e': case 'E': e1:
+    case 'f': if ((d = *(double *)(v += 8)) < 0) { sign = 1; d = -d; } d = d * pow(10.0,prec); p = b + sizeof(b)-1; i = prec;
+              while (i >= 0 || d > 0.0) { if (!i-- && prec) *--p = '.'; *--p = '0' + ((d > 1000000000000000.0) ? 0 : ((int)fmod(d+0.5,10.0))); d = floor(d * 0.1); }
+              i = (b + sizeof(b)-1) - p; break;
+    case 'g': case 'G': c -= 2; if ((d = *(double *)(v += 8)) < 0) { sign = 1; d = -d; } if (d < 0.0001 || d >= pow(10.0,prec)) goto e1;
+              p = "<g>"; i = 3; break;
+    default: *e++ = c; continue;
+    }
+    fmin -= i + sign;
+    if (sign && fill == '0') *e++ = '-';
+    if (!left && fmin > 0) { memset(e, fill, fmin); e += fmin; }
+    if (sign && fill == ' ') *e++ = '-';
+    memcpy(e, p, i); e += i;
+    if (left && fmin > 0) { memset(e, fill, fmin); e += fmin; }
+  }
+  *e = 0;
+  return e - s;
+}
 
 int cpu(uint pc, int argc, char **argv)
 {
-  uint a, b, c, sp, cycle = 0;
-  int ir;
+  uint a, b, c, sp, xpc, cycle = 0;
+  int ir, t;
   double f, g;
+  void *op[256], *pb[BGEF - BZ + 1];
+
+  // direct threaded dispatch, one handler per opcode
+  for (op[0] = &&do_bad, t = 1; t < 256; t += t) memcpy(op + t, op, t * sizeof(void *)); // fill by doubling
+  op[HALT] = &&do_halt; op[MCPY] = &&do_mcpy; op[MCMP] = &&do_mcmp; op[MCHR] = &&do_mchr;
+  op[MSET] = &&do_mset; op[POW] = &&do_pow; op[ATN2] = &&do_atn2; op[FABS] = &&do_fabs; op[ATAN] = &&do_atan;
+  op[LOG] = &&do_log; op[LOGT] = &&do_logt; op[EXP] = &&do_exp; op[FLOR] = &&do_flor; op[CEIL] = &&do_ceil;
+  op[HYPO] = &&do_hypo; op[SIN] = &&do_sin; op[COS] = &&do_cos; op[TAN] = &&do_tan; op[ASIN] = &&do_asin;
+  op[ACOS] = &&do_acos; op[SINH] = &&do_sinh; op[COSH] = &&do_cosh; op[TANH] = &&do_tanh;
+  op[SQRT] = &&do_sqrt; op[FMOD] = &&do_fmod; op[ENT] = &&do_ent; op[LEV] = &&do_lev; op[JMP] = &&do_jmp;
+  op[JMPI] = &&do_jmpi; op[JSR] = &&do_jsr; op[JSRA] = &&do_jsra; op[PSHA] = &&do_psha; op[PSHB] = &&do_pshb;
+  op[PSHC] = &&do_pshc; op[PSHF] = &&do_pshf; op[PSHG] = &&do_pshg; op[PSHI] = &&do_pshi;
+  op[POPA] = &&do_popa; op[POPB] = &&do_popb; op[POPC] = &&do_popc; op[POPF] = &&do_popf;
+  op[POPG] = &&do_popg; op[LEA] = &&do_lea; op[LEAG] = &&do_leag; op[LL] = &&do_ll; op[LLS] = &&do_lls;
+  op[LLH] = &&do_llh; op[LLC] = &&do_llc; op[LLB] = &&do_llb; op[LLD] = &&do_lld; op[LLF] = &&do_llf;
+  op[LG] = &&do_lg; op[LGS] = &&do_lgs; op[LGH] = &&do_lgh; op[LGC] = &&do_lgc; op[LGB] = &&do_lgb;
+  op[LGD] = &&do_lgd; op[LGF] = &&do_lgf; op[LX] = &&do_lx; op[LXS] = &&do_lxs; op[LXH] = &&do_lxh;
+  op[LXC] = &&do_lxc; op[LXB] = &&do_lxb; op[LXD] = &&do_lxd; op[LXF] = &&do_lxf; op[LI] = &&do_li;
+  op[LHI] = &&do_lhi; op[LIF] = &&do_lif; op[LBL] = &&do_lbl; op[LBLS] = &&do_lbls; op[LBLH] = &&do_lblh;
+  op[LBLC] = &&do_lblc; op[LBLB] = &&do_lblb; op[LBLD] = &&do_lbld; op[LBLF] = &&do_lblf; op[LBG] = &&do_lbg;
+  op[LBGS] = &&do_lbgs; op[LBGH] = &&do_lbgh; op[LBGC] = &&do_lbgc; op[LBGB] = &&do_lbgb;
+  op[LBGD] = &&do_lbgd; op[LBGF] = &&do_lbgf; op[LBX] = &&do_lbx; op[LBXS] = &&do_lbxs; op[LBXH] = &&do_lbxh;
+  op[LBXC] = &&do_lbxc; op[LBXB] = &&do_lbxb; op[LBXD] = &&do_lbxd; op[LBXF] = &&do_lbxf; op[LBI] = &&do_lbi;
+  op[LBHI] = &&do_lbhi; op[LBIF] = &&do_lbif; op[LCL] = &&do_lcl; op[LBA] = &&do_lba; op[LCA] = &&do_lca;
+  op[LBAD] = &&do_lbad; op[SL] = &&do_sl; op[SLH] = &&do_slh; op[SLB] = &&do_slb; op[SLD] = &&do_sld;
+  op[SLF] = &&do_slf; op[SG] = &&do_sg; op[SGH] = &&do_sgh; op[SGB] = &&do_sgb; op[SGD] = &&do_sgd;
+  op[SGF] = &&do_sgf; op[SX] = &&do_sx; op[SXH] = &&do_sxh; op[SXB] = &&do_sxb; op[SXD] = &&do_sxd;
+  op[SXF] = &&do_sxf; op[ADDF] = &&do_addf; op[SUBF] = &&do_subf; op[MULF] = &&do_mulf; op[DIVF] = &&do_divf;
+  op[ADD] = &&do_add; op[ADDI] = &&do_addi; op[ADDL] = &&do_addl; op[SUB] = &&do_sub; op[SUBI] = &&do_subi;
+  op[SUBL] = &&do_subl; op[MUL] = &&do_mul; op[MULI] = &&do_muli; op[MULL] = &&do_mull; op[DIV] = &&do_div;
+  op[DIVI] = &&do_divi; op[DIVL] = &&do_divl; op[DVU] = &&do_dvu; op[DVUI] = &&do_dvui; op[DVUL] = &&do_dvul;
+  op[MOD] = &&do_mod; op[MODI] = &&do_modi; op[MODL] = &&do_modl; op[MDU] = &&do_mdu; op[MDUI] = &&do_mdui;
+  op[MDUL] = &&do_mdul; op[AND] = &&do_and; op[ANDI] = &&do_andi; op[ANDL] = &&do_andl; op[OR] = &&do_or;
+  op[ORI] = &&do_ori; op[ORL] = &&do_orl; op[XOR] = &&do_xor; op[XORI] = &&do_xori; op[XORL] = &&do_xorl;
+  op[SHL] = &&do_shl; op[SHLI] = &&do_shli; op[SHLL] = &&do_shll; op[SHR] = &&do_shr; op[SHRI] = &&do_shri;
+  op[SHRL] = &&do_shrl; op[SRU] = &&do_sru; op[SRUI] = &&do_srui; op[SRUL] = &&do_srul; op[EQ] = &&do_eq;
+  op[EQF] = &&do_eqf; op[NE] = &&do_ne; op[NEF] = &&do_nef; op[LT] = &&do_lt; op[LTU] = &&do_ltu;
+  op[LTF] = &&do_ltf; op[GE] = &&do_ge; op[GEU] = &&do_geu; op[GEF] = &&do_gef; op[BZ] = &&do_bz;
+  op[BZF] = &&do_bzf; op[BNZ] = &&do_bnz; op[BNZF] = &&do_bnzf; op[BE] = &&do_be; op[BEF] = &&do_bef;
+  op[BNE] = &&do_bne; op[BNEF] = &&do_bnef; op[BLT] = &&do_blt; op[BLTU] = &&do_bltu; op[BLTF] = &&do_bltf;
+  op[BGE] = &&do_bge; op[BGEU] = &&do_bgeu; op[BGEF] = &&do_bgef; op[CID] = &&do_cid; op[CUD] = &&do_cud;
+  op[CDI] = &&do_cdi; op[CDU] = &&do_cdu; op[SSP] = &&do_ssp; op[NOP] = &&do_nop; op[CYC] = &&do_cyc;
+  op[TRAP] = &&do_trap;
+  if (prof) for (t = BZ; t <= BGEF; t++) { pb[t - BZ] = op[t]; op[t] = &&do_prof; }
 
   sp = ((uint)sbrk(STACKSZ) + STACKSZ - 28) & -8;
 
@@ -29,262 +130,262 @@ int cpu(uint pc, int argc, char **argv)
   ((uint *)sp)[4] = (uint) argv;
   ((uint *)sp)[6] = TRAP | (S_exit<<8); // call exit if main returns
 
+  xpc = pc; // cycles are counted a straight run at a time, from xpc up to each taken jump
   for (;;) {
-    if (sp & 7) { dprintf(2,"stack pointer not a multiple of 8! sp = %u\n", sp); return -1; }
-    cycle++;
     ir = *(int *)pc;
     pc += 4;
-    switch ((uchar)ir) {
-    case HALT: dprintf(2,"halted! a = %d cycle = %u\n", a, cycle); return -1; // XXX supervisor mode
+    goto *op[(uchar)ir];
+
+    do_halt:   dprintf(2,"halted! a = %d cycle = %u\n", a, cycle + ((pc - xpc)>>2)); return -1; // XXX supervisor mode
 
     // memory
-    case MCPY: memcpy((void *)a, (void *)b, c); a += c; b += c; c = 0; continue;
-    case MCMP: a = memcmp((void *)a, (void *)b, c); b += c; c = 0; continue;
-    case MCHR: if (a = (uint)memchr((void *)a, b, c)) c = 0; continue;
-    case MSET: memset((void *)a, b, c); a += c; c = 0; continue;
+    do_mcpy:   memcpy((void *)a, (void *)b, c); a += c; b += c; c = 0; continue;
+    do_mcmp:   a = memcmp((void *)a, (void *)b, c); b += c; c = 0; continue;
+    do_mchr:   if (a = (uint)memchr((void *)a, b, c)) c = 0; continue;
+    do_mset:   memset((void *)a, b, c); a += c; c = 0; continue;
 
     // math
-    case POW:  f = pow(f,g); continue;
-    case ATN2: f = atan2(f,g); continue;
-    case FABS: f = fabs(f); continue;
-    case ATAN: f = atan(f); continue;
-    case LOG:  f = log(f); continue;
-    case LOGT: f = log10(f); continue;
-    case EXP:  f = exp(f); continue;
-    case FLOR: f = floor(f); continue;
-    case CEIL: f = ceil(f); continue;
-    case HYPO: f = hypot(f,g); continue;
-    case SIN:  f = sin(f); continue;
-    case COS:  f = cos(f); continue;
-    case TAN:  f = tan(f); continue;
-    case ASIN: f = asin(f); continue;
-    case ACOS: f = acos(f); continue;
-    case SINH: f = sinh(f); continue;
-    case COSH: f = cosh(f); continue;
-    case TANH: f = tanh(f); continue;
-    case SQRT: f = sqrt(f); continue;
-    case FMOD: f = fmod(f,g); continue;
+    do_pow:    f = pow(f,g); continue;
+    do_atn2:   f = atan2(f,g); continue;
+    do_fabs:   f = fabs(f); continue;
+    do_atan:   f = atan(f); continue;
+    do_log:    f = log(f); continue;
+    do_logt:   f = log10(f); continue;
+    do_exp:    f = exp(f); continue;
+    do_flor:   f = floor(f); continue;
+    do_ceil:   f = ceil(f); continue;
+    do_hypo:   f = hypot(f,g); continue;
+    do_sin:    f = sin(f); continue;
+    do_cos:    f = cos(f); continue;
+    do_tan:    f = tan(f); continue;
+    do_asin:   f = asin(f); continue;
+    do_acos:   f = acos(f); continue;
+    do_sinh:   f = sinh(f); continue;
+    do_cosh:   f = cosh(f); continue;
+    do_tanh:   f = tanh(f); continue;
+    do_sqrt:   f = sqrt(f); continue;
+    do_fmod:   f = fmod(f,g); continue;
 
     // procedure linkage
-    case ENT:  sp += ir>>8; continue;
-    case LEV:  sp += ir>>8; pc = *(uint *)sp; sp += 8; continue;
+    do_ent:    sp += ir>>8; if (sp & 7) goto badsp; continue;
+    do_lev:    sp += ir>>8; if (sp & 7) goto badsp; cycle += (pc - xpc)>>2; xpc = pc = *(uint *)sp; sp += 8; continue;
 
     // jump
-    case JMP:  pc += ir>>8; continue;
-    case JMPI: pc += ((uint *)(pc + (ir>>8)))[a]; continue;
-    case JSR:  sp -= 8; *(uint *)sp = pc; pc += ir>>8; continue;
-    case JSRA: sp -= 8; *(uint *)sp = pc; pc = a; continue;
+    do_jmp:    cycle += (pc - xpc)>>2; xpc = pc += ir>>8; continue;
+    do_jmpi:   cycle += (pc - xpc)>>2; xpc = pc += ((uint *)(pc + (ir>>8)))[a]; continue;
+    do_jsr:    sp -= 8; *(uint *)sp = pc; cycle += (pc - xpc)>>2; xpc = pc += ir>>8; continue;
+    do_jsra:   sp -= 8; *(uint *)sp = pc; cycle += (pc - xpc)>>2; xpc = pc = a; continue;
 
     // stack
-    case PSHA: sp -= 8; *(uint *)sp = a; continue;
-    case PSHB: sp -= 8; *(uint *)sp = b; continue;
-    case PSHC: sp -= 8; *(uint *)sp = c; continue;
-    case PSHF: sp -= 8; *(double *)sp = f; continue;
-    case PSHG: sp -= 8; *(double *)sp = g; continue;
-    case PSHI: sp -= 8; *(uint *)sp = ir>>8; continue;
-
-    case POPA: a = *(uint *)sp; sp += 8; continue;
-    case POPB: b = *(uint *)sp; sp += 8; continue;
-    case POPC: c = *(uint *)sp; sp += 8; continue;
-    case POPF: f = *(double *)sp; sp += 8; continue;
-    case POPG: g = *(double *)sp; sp += 8; continue;
+    do_psha:   sp -= 8; *(uint *)sp = a; continue;
+    do_pshb:   sp -= 8; *(uint *)sp = b; continue;
+    do_pshc:   sp -= 8; *(uint *)sp = c; continue;
+    do_pshf:   sp -= 8; *(double *)sp = f; continue;
+    do_pshg:   sp -= 8; *(double *)sp = g; continue;
+    do_pshi:   sp -= 8; *(uint *)sp = ir>>8; continue;
+
+    do_popa:   a = *(uint *)sp; sp += 8; continue;
+    do_popb:   b = *(uint *)sp; sp += 8; continue;
+    do_popc:   c = *(uint *)sp; sp += 8; continue;
+    do_popf:   f = *(double *)sp; sp += 8; continue;
+    do_popg:   g = *(double *)sp; sp += 8; continue;
 
     // load effective address
-    case LEA:  a = sp + (ir>>8); continue;
-    case LEAG: a = pc + (ir>>8); continue;
+    do_lea:    a = sp + (ir>>8); continue;
+    do_leag:   a = pc + (ir>>8); continue;
 
     // load a local
-    case LL:   a = *(uint *)   (sp + (ir>>8)); continue;
-    case LLS:  a = *(short *)  (sp + (ir>>8)); continue;
-    case LLH:  a = *(ushort *) (sp + (ir>>8)); continue;
-    case LLC:  a = *(char *)   (sp + (ir>>8)); continue;
-    case LLB:  a = *(uchar *)  (sp + (ir>>8)); continue;
-    case LLD:  f = *(double *) (sp + (ir>>8)); continue;
-    case LLF:  f = *(float *)  (sp + (ir>>8)); continue;
+    do_ll:     a = *(uint *)   (sp + (ir>>8)); continue;
+    do_lls:    a = *(short *)  (sp + (ir>>8)); continue;
+    do_llh:    a = *(ushort *) (sp + (ir>>8)); continue;
+    do_llc:    a = *(char *)   (sp + (ir>>8)); continue;
+    do_llb:    a = *(uchar *)  (sp + (ir>>8)); continue;
+    do_lld:    f = *(double *) (sp + (ir>>8)); continue;
+    do_llf:    f = *(float *)  (sp + (ir>>8)); continue;
 
     // load a global
-    case LG:   a = *(uint *)   (pc + (ir>>8)); continue;
-    case LGS:  a = *(short *)  (pc + (ir>>8)); continue;
-    case LGH:  a = *(ushort *) (pc + (ir>>8)); continue;
-    case LGC:  a = *(char *)   (pc + (ir>>8)); continue;
-    case LGB:  a = *(uchar *)  (pc + (ir>>8)); continue;
-    case LGD:  f = *(double *) (pc + (ir>>8)); continue;
-    case LGF:  f = *(float *)  (pc + (ir>>8)); continue;
+    do_lg:     a = *(uint *)   (pc + (ir>>8)); continue;
+    do_lgs:    a = *(short *)  (pc + (ir>>8)); continue;
+    do_lgh:    a = *(ushort *) (pc + (ir>>8)); continue;
+    do_lgc:    a = *(char *)   (pc + (ir>>8)); continue;
+    do_lgb:    a = *(uchar *)  (pc + (ir>>8)); continue;
+    do_lgd:    f = *(double *) (pc + (ir>>8)); continue;
+    do_lgf:    f = *(float *)  (pc + (ir>>8)); continue;
 
     // load a indexed
-    case LX:   a = *(uint *)   (a + (ir>>8)); continue;
-    case LXS:  a = *(short *)  (a + (ir>>8)); continue;
-    case LXH:  a = *(ushort *) (a + (ir>>8)); continue;
-    case LXC:  a = *(char *)   (a + (ir>>8)); continue;
-    case LXB:  a = *(uchar *)  (a + (ir>>8)); continue;
-    case LXD:  f = *(double *) (a + (ir>>8)); continue;
-    case LXF:  f = *(float *)  (a + (ir>>8)); continue;
+    do_lx:     a = *(uint *)   (a + (ir>>8)); continue;
+    do_lxs:    a = *(short *)  (a + (ir>>8)); continue;
+    do_lxh:    a = *(ushort *) (a + (ir>>8)); continue;
+    do_lxc:    a = *(char *)   (a + (ir>>8)); continue;
+    do_lxb:    a = *(uchar *)  (a + (ir>>8)); continue;
+    do_lxd:    f = *(double *) (a + (ir>>8)); continue;
+    do_lxf:    f = *(float *)  (a + (ir>>8)); continue;
 
     // load a immediate
-    case LI:   a = ir>>8; continue;
-    case LHI:  a = a<<24 | (uint)ir>>8; continue;
-    case LIF:  f = (ir>>8)/256.0; continue;
+    do_li:     a = ir>>8; continue;
+    do_lhi:    a = a<<24 | (uint)ir>>8; continue;
+    do_lif:    f = (ir>>8)/256.0; continue;
 
     // load b local
-    case LBL:  b = *(uint *)   (sp + (ir>>8)); continue;
-    case LBLS: b = *(short *)  (sp + (ir>>8)); continue;
-    case LBLH: b = *(ushort *) (sp + (ir>>8)); continue;
-    case LBLC: b = *(char *)   (sp + (ir>>8)); continue;
-    case LBLB: b = *(uchar *)  (sp + (ir>>8)); continue;
-    case LBLD: g = *(double *) (sp + (ir>>8)); continue;
-    case LBLF: g = *(float *)  (sp + (ir>>8)); continue;
+    do_lbl:    b = *(uint *)   (sp + (ir>>8)); continue;
+    do_lbls:   b = *(short *)  (sp + (ir>>8)); continue;
+    do_lblh:   b = *(ushort *) (sp + (ir>>8)); continue;
+    do_lblc:   b = *(char *)   (sp + (ir>>8)); continue;
+    do_lblb:   b = *(uchar *)  (sp + (ir>>8)); continue;
+    do_lbld:   g = *(double *) (sp + (ir>>8)); continue;
+    do_lblf:   g = *(float *)  (sp + (ir>>8)); continue;
 
     // load b global
-    case LBG:  b = *(uint *)   (pc + (ir>>8)); continue;
-    case LBGS: b = *(short *)  (pc + (ir>>8)); continue;
-    case LBGH: b = *(ushort *) (pc + (ir>>8)); continue;
-    case LBGC: b = *(char *)   (pc + (ir>>8)); continue;
-    case LBGB: b = *(uchar *)  (pc + (ir>>8)); continue;
-    case LBGD: g = *(double *) (pc + (ir>>8)); continue;
-    case LBGF: g = *(float *)  (pc + (ir>>8)); continue;
+    do_lbg:    b = *(uint *)   (pc + (ir>>8)); continue;
+    do_lbgs:   b = *(short *)  (pc + (ir>>8)); continue;
+    do_lbgh:   b = *(ushort *) (pc + (ir>>8)); continue;
+    do_lbgc:   b = *(char *)   (pc + (ir>>8)); continue;
+    do_lbgb:   b = *(uchar *)  (pc + (ir>>8)); continue;
+    do_lbgd:   g = *(double *) (pc + (ir>>8)); continue;
+    do_lbgf:   g = *(float *)  (pc + (ir>>8)); continue;
 
     // load b indexed
-    case LBX:  b = *(uint *)   (b + (ir>>8)); continue;
-    case LBXS: b = *(short *)  (b + (ir>>8)); continue;
-    case LBXH: b = *(ushort *) (b + (ir>>8)); continue;
-    case LBXC: b = *(char *)   (b + (ir>>8)); continue;
-    case LBXB: b = *(uchar *)  (b + (ir>>8)); continue;
-    case LBXD: g = *(double *) (b + (ir>>8)); continue;
-    case LBXF: g = *(float *)  (b + (ir>>8)); continue;
+    do_lbx:    b = *(uint *)   (b + (ir>>8)); continue;
+    do_lbxs:   b = *(short *)  (b + (ir>>8)); continue;
+    do_lbxh:   b = *(ushort *) (b + (ir>>8)); continue;
+    do_lbxc:   b = *(char *)   (b + (ir>>8)); continue;
+    do_lbxb:   b = *(uchar *)  (b + (ir>>8)); continue;
+    do_lbxd:   g = *(double *) (b + (ir>>8)); continue;
+    do_lbxf:   g = *(float *)  (b + (ir>>8)); continue;
 
     // load b immediate
-    case LBI:  b = ir>>8; continue;
-    case LBHI: b = b<<24 | (uint)ir>>8; continue;
-    case LBIF: g = (ir>>8)/256.0; continue;
+    do_lbi:    b = ir>>8; continue;
+    do_lbhi:   b = b<<24 | (uint)ir>>8; continue;
+    do_lbif:   g = (ir>>8)/256.0; continue;
 
     // misc transfer
-    case LCL:  c = *(uint *)(sp + (ir>>8)); continue;
-    case LBA:  b = a; continue;
-    case LCA:  c = a; continue;
-    case LBAD: g = f; continue;
+    do_lcl:    c = *(uint *)(sp + (ir>>8)); continue;
+    do_lba:    b = a; continue;
+    do_lca:    c = a; continue;
+    do_lbad:   g = f; continue;
 
     // store a local
-    case SL:   *(uint *)   (sp + (ir>>8)) = a; continue;
-    case SLH:  *(ushort *) (sp + (ir>>8)) = a; continue;
-    case SLB:  *(uchar *)  (sp + (ir>>8)) = a; continue;
-    case SLD:  *(double *) (sp + (ir>>8)) = f; continue;
-    case SLF:  *(float *)  (sp + (ir>>8)) = f; continue;
+    do_sl:     *(uint *)   (sp + (ir>>8)) = a; continue;
+    do_slh:    *(ushort *) (sp + (ir>>8)) = a; continue;
+    do_slb:    *(uchar *)  (sp + (ir>>8)) = a; continue;
+    do_sld:    *(double *) (sp + (ir>>8)) = f; continue;
+    do_slf:    *(float *)  (sp + (ir>>8)) = f; continue;
 
     // store a global
-    case SG:   *(uint *)   (pc + (ir>>8)) = a; continue;
-    case SGH:  *(ushort *) (pc + (ir>>8)) = a; continue;
-    case SGB:  *(uchar *)  (pc + (ir>>8)) = a; continue;
-    case SGD:  *(double *) (pc + (ir>>8)) = f; continue;
-    case SGF:  *(float *)  (pc + (ir>>8)) = f; continue;
+    do_sg:     *(uint *)   (pc + (ir>>8)) = a; continue;
+    do_sgh:    *(ushort *) (pc + (ir>>8)) = a; continue;
+    do_sgb:    *(uchar *)  (pc + (ir>>8)) = a; continue;
+    do_sgd:    *(double *) (pc + (ir>>8)) = f; continue;
+    do_sgf:    *(float *)  (pc + (ir>>8)) = f; continue;
 
     // store a indexed
-    case SX:   *(uint *)   (b + (ir>>8)) = a; continue;
-    case SXH:  *(ushort *) (b + (ir>>8)) = a; continue;
-    case SXB:  *(uchar *)  (b + (ir>>8)) = a; continue;
-    case SXD:  *(double *) (b + (ir>>8)) = f; continue;
-    case SXF:  *(float *)  (b + (ir>>8)) = f; continue;
+    do_sx:     *(uint *)   (b + (ir>>8)) = a; continue;
+    do_sxh:    *(ushort *) (b + (ir>>8)) = a; continue;
+    do_sxb:    *(uchar *)  (b + (ir>>8)) = a; continue;
+    do_sxd:    *(double *) (b + (ir>>8)) = f; continue;
+    do_sxf:    *(float *)  (b + (ir>>8)) = f; continue;
 
     // arithmetic
-    case ADDF: f += g; continue;
-    case SUBF: f -= g; continue;
-    case MULF: f *= g; continue;
-    case DIVF: f /= g; continue;
+    do_addf:   f += g; continue;
+    do_subf:   f -= g; continue;
+    do_mulf:   f *= g; continue;
+    do_divf:   f /= g; continue;
 
-    case ADD:  a += b; continue;
-    case ADDI: a += ir>>8; continue;
-    case ADDL: a += *(uint *)(sp + (ir>>8)); continue;
+    do_add:    a += b; continue;
+    do_addi:   a += ir>>8; continue;
+    do_addl:   a += *(uint *)(sp + (ir>>8)); continue;
 
-    case SUB:  a -= b; continue;
-    case SUBI: a -= ir>>8; continue;
-    case SUBL: a -= *(uint *)(sp + (ir>>8)); continue;
+    do_sub:    a -= b; continue;
+    do_subi:   a -= ir>>8; continue;
+    do_subl:   a -= *(uint *)(sp + (ir>>8)); continue;
 
-    case MUL:  a *= b; continue;
-    case MULI: a *= ir>>8; continue;
-    case MULL: a *= *(uint *)(sp + (ir>>8)); continue;
+    do_mul:    a *= b; continue;
+    do_muli:   a *= ir>>8; continue;
+    do_mull:   a *= *(uint *)(sp + (ir>>8)); continue;
 
-    case DIV:  a = (int)a / (int)b; continue;
-    case DIVI: a = (int)a / (ir>>8); continue;
-    case DIVL: a = (int)a / *(int *)(sp + (ir>>8)); continue;
+    do_div:    a = (int)a / (int)b; continue;
+    do_divi:   a = (int)a / (ir>>8); continue;
+    do_divl:   a = (int)a / *(int *)(sp + (ir>>8)); continue;
 
-    case DVU:  a /= b; continue;
-    case DVUI: a /= ir>>8; continue;
-    case DVUL: a /= *(uint *)(sp + (ir>>8)); continue;
+    do_dvu:    a /= b; continue;
+    do_dvui:   a /= ir>>8; continue;
+    do_dvul:   a /= *(uint *)(sp + (ir>>8)); continue;
 
-    case MOD:  a = (int)a % (int)b; continue;
-    case MODI: a = (int)a % (ir>>8); continue;
-    case MODL: a = (int)a % *(int *)(sp + (ir>>8)); continue;
+    do_mod:    a = (int)a % (int)b; continue;
+    do_modi:   a = (int)a % (ir>>8); continue;
+    do_modl:   a = (int)a % *(int *)(sp + (ir>>8)); continue;
 
-    case MDU:  a %= b; continue;
-    case MDUI: a %= ir>>8; continue;
-    case MDUL: a %= *(uint *)(sp + (ir>>8)); continue;
+    do_mdu:    a %= b; continue;
+    do_mdui:   a %= ir>>8; continue;
+    do_mdul:   a %= *(uint *)(sp + (ir>>8)); continue;
 
-    case AND:  a &= b; continue;
-    case ANDI: a &= ir>>8; continue;
-    case ANDL: a &= *(uint *)(sp + (ir>>8)); continue;
+    do_and:    a &= b; continue;
+    do_andi:   a &= ir>>8; continue;
+    do_andl:   a &= *(uint *)(sp + (ir>>8)); continue;
 
-    case OR:   a |= b; continue;
-    case ORI:  a |= ir>>8; continue;
-    case ORL:  a |= *(uint *)(sp + (ir>>8)); continue;
+    do_or:     a |= b; continue;
+    do_ori:    a |= ir>>8; continue;
+    do_orl:    a |= *(uint *)(sp + (ir>>8)); continue;
 
-    case XOR:  a ^= b; continue;
-    case XORI: a ^= ir>>8; continue;
-    case XORL: a ^= *(uint *)(sp + (ir>>8)); continue;
+    do_xor:    a ^= b; continue;
+    do_xori:   a ^= ir>>8; continue;
+    do_xorl:   a ^= *(uint *)(sp + (ir>>8)); continue;
 
-    case SHL:  a <<= b; continue;
-    case SHLI: a <<= ir>>8; continue;
-    case SHLL: a <<= *(uint *)(sp + (ir>>8)); continue;
+    do_shl:    a <<= b; continue;
+    do_shli:   a <<= ir>>8; continue;
+    do_shll:   a <<= *(uint *)(sp + (ir>>8)); continue;
 
-    case SHR:  a = (int)a >> (int)b; continue;
-    case SHRI: a = (int)a >> (ir>>8); continue;
-    case SHRL: a = (int)a >> *(int *)(sp + (ir>>8)); continue;
+    do_shr:    a = (int)a >> (int)b; continue;
+    do_shri:   a = (int)a >> (ir>>8); continue;
+    do_shrl:   a = (int)a >> *(int *)(sp + (ir>>8)); continue;
 
-    case SRU:  a >>= b; continue;
-    case SRUI: a >>= ir>>8; continue;
-    case SRUL: a >>= *(uint *)(sp + (ir>>8)); continue;
+    do_sru:    a >>= b; continue;
+    do_srui:   a >>= ir>>8; continue;
+    do_srul:   a >>= *(uint *)(sp + (ir>>8)); continue;
 
     // logical
-    case EQ:   a = a == b; continue;
-    case EQF:  a = f == g; continue;
-    case NE:   a = a != b; continue;
-    case NEF:  a = f != g; continue;
-    case LT:   a = (int)a < (int)b; continue;
-    case LTU:  a = a < b; continue;
-    case LTF:  a = f < g; continue;
-    case GE:   a = (int)a >= (int)b; continue;
-    case GEU:  a = a >= b; continue;
-    case GEF:  a = f >= g; continue;
+    do_eq:     a = a == b; continue;
+    do_eqf:    a = f == g; continue;
+    do_ne:     a = a != b; continue;
+    do_nef:    a = f != g; continue;
+    do_lt:     a = (int)a < (int)b; continue;
+    do_ltu:    a = a < b; continue;
+    do_ltf:    a = f < g; continue;
+    do_ge:     a = (int)a >= (int)b; continue;
+    do_geu:    a = a >= b; continue;
+    do_gef:    a = f >= g; continue;
 
     // branch
-    case BZ:   if (!a)               pc += ir>>8; continue;
-    case BZF:  if (!f)               pc += ir>>8; continue;
-    case BNZ:  if (a)                pc += ir>>8; continue;
-    case BNZF: if (f)                pc += ir>>8; continue;
-    case BE:   if (a == b)           pc += ir>>8; continue;
-    case BEF:  if (f == g)           pc += ir>>8; continue;
-    case BNE:  if (a != b)           pc += ir>>8; continue;
-    case BNEF: if (f != g)           pc += ir>>8; continue;
-    case BLT:  if ((int)a < (int)b)  pc += ir>>8; continue;
-    case BLTU: if (a < b)            pc += ir>>8; continue;
-    case BLTF: if (f < g)            pc += ir>>8; continue;
-    case BGE:  if ((int)a >= (int)b) pc += ir>>8; continue;
-    case BGEU: if (a >= b)           pc += ir>>8; continue;
-    case BGEF: if (f >= g)           pc += ir>>8; continue;
+    do_bz:     if (!a)               goto taken; continue;
+    do_bzf:    if (!f)               goto taken; continue;
+    do_bnz:    if (a)                goto taken; continue;
+    do_bnzf:   if (f)                goto taken; continue;
+    do_be:     if (a == b)           goto taken; continue;
+    do_bef:    if (f == g)           goto taken; continue;
+    do_bne:    if (a != b)           goto taken; continue;
+    do_bnef:   if (f != g)           goto taken; continue;
+    do_blt:    if ((int)a < (int)b)  goto taken; continue;
+    do_bltu:   if (a < b)            goto taken; continue;
+    do_bltf:   if (f < g)            goto taken; continue;
+    do_bge:    if ((int)a >= (int)b) goto taken; continue;
+    do_bgeu:   if (a >= b)           goto taken; continue;
+    do_bgef:   if (f >= g)           goto taken; continue;
 
     // conversion
-    case CID:  f = (int)a; continue;
-    case CUD:  f = a; continue;
-    case CDI:  a = (int)f; continue;
-    case CDU:  a = f; continue;
+    do_cid:    f = (int)a; continue;
+    do_cud:    f = a; continue;
+    do_cdi:    a = (int)f; continue;
+    do_cdu:    a = f; continue;
 
     // misc
-    case SSP:  sp = a; continue;
-    case NOP:  continue;
-    case CYC:  a = cycle; continue;
+    do_ssp:    sp = a; if (sp & 7) goto badsp; continue;
+    do_nop:    continue;
+    do_cyc:    a = cycle + ((pc - xpc)>>2); continue;
 
-    case TRAP:
+    do_trap:  
       switch (ir>>8) {
       case S_fork:    a = fork();                          continue; // fork()
-      case S_exit:    if (verbose) dprintf(2,"exit(%d) cycle = %u\n", a, cycle); return a; // exit(rc)
+      case S_exit:    if (verbose) dprintf(2,"exit(%d) cycle = %u\n", a, cycle + ((pc - xpc)>>2)); return a; // exit(rc)
       case S_wait:    a = wait();                          continue; // wait()
       case S_pipe:    a = pipe((void *)a);                 continue; // pipe(&fd)
       case S_write:   a = write(a, (void *)b, c);          continue; // write(fd, p, n)
@@ -304,7 +405,7 @@ int cpu(uint pc, int argc, char **argv)
       case S_sbrk:    a = (uint)sbrk(a);                   continue; // sbrk(size)
       case S_sleep:   a = sleep(a);                        continue; // sleep(msec) XXX msec vs sec
       case S_uptime:  a = uptime();                        continue; // uptime()
-      case S_lseek:   a = lseek(a, b, c);                  continue; // lseek(fd, pos, whence)
+      case S_lseek:   a = lseek(a, (int)b, c);             continue; // lseek(fd, pos, whence)
       case S_mount:   a = mount((void *)a, (void *)b, c);  continue; // mount(spec, dir, rwflag)
       case S_umount:  a = umount((void *)a);               continue; // umount(spec)
       case S_socket:  a = socket(a, b, c);                 continue; // socket(family, type, protocol)
@@ -313,6 +414,15 @@ int cpu(uint pc, int argc, char **argv)
       case S_poll:    a = poll((void *)a, b, c);           continue; // poll(pfd, n, msec)
       case S_accept:  a = accept(a, (void *)b, (void *)c); continue; // accept(fd, addr, addrlen)
       case S_connect: a = connect(a, (void *)b, c);        continue; // connect(fd, addr, addrlen)
+      case S_sendfile: a = sendfile(a, b, c);              continue; // sendfile(out, in, n)
+      case S_mmap:    a = (uint)mmap(((uint *)a)[0], ((uint *)a)[2], ((uint *)a)[4], ((uint *)a)[6], ((uint *)a)[8], ((uint *)a)[10]); continue; // mmap(addr, len, prot, flags, fd, off)
+      case S_munmap:  a = munmap((void *)a, b);            continue; // munmap(addr, len)
+
+      case S_host:    a = 0;                               continue; // host intrinsics are here
+      case S_vsprintf: a = uvsprintf((char *)a, (char *)b, (char *)c); continue; // vsprintf(s, fmt, v)
+      case S_strcmp:  a = ustrcmp((char *)a, (char *)b);   continue; // strcmp(d, s)
+      case S_strncmp: a = ustrncmp((char *)a, (char *)b, c); continue; // strncmp(d, s, n)
+      case S_strstr:  a = (uint)strstr((char *)a, (char *)b); continue; // strstr(s, t)
 
 //      case S_shutdown:
 //      case S_getsockopt:
@@ -320,33 +430,39 @@ int cpu(uint pc, int argc, char **argv)
 //      case S_getpeername:
 //      case S_getsockname:
 
-      default: dprintf(2,"unsupported trap cycle = %u pc = %08x ir = %08x a = %d b = %d c = %d", cycle, pc, ir, a, b, c); return -1;
+      default: dprintf(2,"unsupported trap cycle = %u pc = %08x ir = %08x a = %d b = %d c = %d", cycle + ((pc - xpc)>>2), pc, ir, a, b, c); return -1;
       }
-    default:   dprintf(2,"unknown instruction cycle = %u pc = %08x ir = %08x\n", cycle, pc, ir); return -1;
-    }
+
+    taken:     if (prof) prof[(pc - 4 - pbase) / 2 + 1]++;
+               cycle += (pc - xpc)>>2; xpc = pc += ir>>8; continue;
+    do_prof:   prof[(pc - 4 - pbase) / 2]++; goto *pb[(uchar)ir - BZ]; // count each run of a branch
+    badsp:     dprintf(2,"stack pointer not a multiple of 8! sp = %u\n", sp); return -1;
+    do_bad:    dprintf(2,"unknown instruction cycle = %u pc = %08x ir = %08x\n", cycle + ((pc - xpc)>>2), pc, ir); return -1;
   }
 }
 
 void usage(void)
 {
-  dprintf(2,"%s : usage: %s [-v] file ...\n", cmd, cmd);
+  dprintf(2,"%s : usage: %s [-v] [-p profile] file ...\n", cmd, cmd);
   exit(-1);
 }
 
 int main(int argc, char *argv[])
 {
-  int f, gs, rc;
+  int f, gs, rc, n, i;
+  uint r[3];
   struct { uint magic, bss, entry, flags; } hdr;
-  char *file;
+  char *file, *pfile;
   struct stat st;
 
   cmd = *argv;
   if (argc < 2) usage();
   file = *++argv;
-  verbose = 0;
+  verbose = 0; pfile = 0;
   while (--argc && *file == '-') {
     switch(file[1]) {
     case 'v': verbose = 1; break;
+    case 'p': if (argc > 1) { pfile = *++argv; argc--; break; }
     default: usage();
     }
     file = *++argv;
@@ -362,8 +478,24 @@ int main(int argc, char *argv[])
   read(f, (void *)gs, st.st_size - sizeof(hdr));
   close(f);
 
+  n = st.st_size - sizeof(hdr);
+  if (pfile) prof = memset(sbrk(n * 2), 0, n * 2);
+  pbase = gs;
+
   if (verbose) dprintf(2,"%s : emulating %s\n", cmd, file);
   rc = cpu(gs + hdr.entry, argc, argv);
   if (verbose) dprintf(2,"%s : %s returned %d.\n", cmd, file, rc);
+
+  if (pfile) { // magic and image size, then the offset, fall through and taken counts of each branch that ran
+    if ((f = open(pfile, O_WRONLY | O_CREAT | O_TRUNC)) < 0) { dprintf(2,"%s : couldn't open %s\n", cmd, pfile); return -1; }
+    r[0] = PRF_MAGIC; r[1] = n;
+    write(f, r, 8);
+    for (i = 0; i < n / 4; i++) {
+      r[0] = i * 4; r[1] = prof[i*2] - prof[i*2+1]; r[2] = prof[i*2+1];
+      if (!r[1] && !r[2]) continue;
+      write(f, r, 12);
+    }
+    close(f);
+  }
   return rc;
 }
@@ -131,13 +131,10 @@ void retr(char *name)
   if ((xd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || connect(xd, (struct sockaddr *)&xaddr, xaddrlen) < 0)
     { reply("550 connect() error"); return; }
 
-  for (size=1;size > 0;) {
-    if ((size = read(file, xbuf, sizeof(xbuf))) < 0) { reply("550 read() error"); break; }
-    if (write(xd, xbuf, size) < 0) {
-      if (verbose) dprintf(2,"send failed\n");
-      reply("426 Broken pipe") ;
-      size = -1;
-    }
+  while ((size = sendfile(xd, file, sizeof(xbuf))) > 0) ;
+  if (size < 0) {
+    if (verbose) dprintf(2,"send failed\n");
+    reply("426 Broken pipe");
   }
 
   if (size >= 0) reply("226 Transfer Complete");   // XXX fix size < 0 nonsense logic
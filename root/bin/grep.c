@@ -8,41 +8,50 @@
 
 #include <u.h>
 #include <libc.h>
+#include <file.h>
 
 char buf[1025];
 int match(char*, char*);
 
-void grep(char *pattern, int fd)
+// search a regular file in place through a private mapping
+int grepmap(char *pattern, int fd)
 {
-  int n, m;
-  char *p, *q;
-  
-  m = 0;
-  while ((n = read(fd, ((char*)buf)+m, 1024-m)) > 0) {
-    m += n;
-    buf[m] = 0;
-    p = buf;
-    while ((q = strchr(p, '\n')) != 0) {
-      *q = 0;
-      if (match(pattern, p)) {
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
+  struct stat st;
+  char *b, *p, *q, *e;
+
+  if (fstat(fd, &st) || (st.st_mode & S_IFMT) != S_IFREG || !st.st_size ||
+      (b = mmap(0, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == (char *)-1) return -1;
+  for (p = b, e = b + st.st_size; p < e; p = q+1) {
+    if (!(q = memchr(p, '\n', e - p))) q = e;
+    *q = 0;
+    if (match(pattern, p)) {
+      *q = '\n';
+      fwrite(p, 1, q+1 - p, stdout);
     }
-    if (p == buf)
-      m = 0;
-    if (m > 0) {
-      m -= p - buf;
-      memcpy(buf, p, m);
+  }
+  munmap(b, st.st_size + 1);
+  return 0;
+}
+
+void grep(char *pattern, FILE *f)
+{
+  char *q;
+
+  if (!grepmap(pattern, fileno(f))) return;
+  while (fgets(buf, sizeof(buf), f)) {
+    if (q = strchr(buf, '\n')) *q = 0;
+    if (match(pattern, buf)) {
+      if (q) *q = '\n';
+      fputs(buf, stdout);
     }
   }
 }
 
 int main(int argc, char *argv[])
 {
-  int fd, i;
+  int i;
   char *pattern;
+  FILE *f;
   
   if (argc <= 1) {
     dprintf(2, "usage: grep pattern [file ...]\n");
@@ -51,17 +60,17 @@ int main(int argc, char *argv[])
   pattern = argv[1];
   
   if (argc <= 2) {
-    grep(pattern, 0);
+    grep(pattern, stdin);
     exit(0);
   }
 
   for (i = 2; i < argc; i++) {
-    if ((fd = open(argv[i], 0)) < 0) {
+    if (!(f = fopen(argv[i], "r"))) {
       dprintf(2, "grep: cannot open %s\n", argv[i]);
       exit(0);
     }
-    grep(pattern, fd);
-    close(fd);
+    grep(pattern, f);
+    fclose(f);
   }
   return 0;
 }
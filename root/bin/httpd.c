@@ -77,7 +77,8 @@ int web(int sd)
   lseek(fd, 0, SEEK_SET);
   dprintf(sd, "HTTP/1.1 200 OK\nServer: httpd/1.0\nContent-Length: %ld\nConnection: close\nContent-Type: %s\n\n", len, ty);
 
-  while ((r = read(fd, buffer, BUFSIZE)) > 0) write(sd, buffer, r);
+  sendfile(sd, fd, len);
+  close(fd);
   //sleep(1); // XXX allow socket to drain before signalling the socket is closed
   close(sd);
   return 0;
@@ -0,0 +1,344 @@
+// ld -- link object files
+//
+// Usage:  ld [-v] -o exefile file.o ...
+//
+// Description:
+//   ld links the relocatable object files made by c -c into an executable.
+//   Functions and globals are matched by name.  A function may be defined by
+//   several objects if the definitions come from an include file, and one is
+//   kept (one outside an include file wins), otherwise a second definition is
+//   an error.  Globals of the same name are a single variable.  The objects that
+//   an object took function bodies from (x.o for the include file x.h) are
+//   linked in as well.  As with c, functions main can not reach through calls
+//   or taken addresses are dropped from the output.
+//
+//   -v  Verbose output.
+//   -o  Executable file to create.
+//
+//   For example,
+//       c -c -o /lib/libc.o /lib/libc.c
+//       c -c main.c
+//       c -c util.c
+//       ld -o prog main.o util.o
+
+#include <u.h>
+#include <libc.h>
+
+enum {
+  SEG_SZ    = 8*1024*1024, // max size of text+data+bss seg
+  PSTACK_SZ =    256*1024, // size of patch lists
+  OBJ_SZ    =          64, // max object files
+  HASH_SZ   =        4096, // number of symbol hash table entries
+  BSS_TAG   =  0x10000000, // tag for bss offsets
+  OBJ_MAGIC =  0xC0DE0B1E, // relocatable object file magic
+};
+
+enum { OBJ_FUN = 1, OBJ_EXT, OBJ_GLO, OBJ_NEED, OBJ_WEAK = 8 }; // object symbol kinds (same in c.c)
+
+typedef struct { // relocatable object file layout (same in c.c)
+  uint magic;
+  int text, data, bss, npdata, npbss, npfun, npbody, nsym, nstr;
+} obj_t;
+
+typedef struct { // object file symbol
+  int name;   // string table offset
+  int kind;   // OBJ_ kind, with OBJ_WEAK if from an include file
+  int val;    // function body start, global data offset (bss ones tagged), or 0
+  int size;   // global size
+} sym_t;
+
+typedef struct def_s { // what a name links to
+  char *name;
+  int kind;   // OBJ_FUN or OBJ_GLO, with OBJ_WEAK
+  int val;    // linked text offset of the function, or data offset of the global (bss ones tagged)
+  int size;
+  struct def_s *next;
+} def_t;
+
+typedef struct { // loaded object
+  char *name;
+  obj_t *h;
+  sym_t *sym;
+  char *str;
+  def_t **def;         // what each symbol links to
+  int text, data, bss; // where its segments start in the output
+  int pdata, pbss;     // where its entries start in the patch lists
+} mod_t;
+
+int ip,       // text segment current offset
+    data,     // data segment current offset
+    bss,      // bss offset
+    errs,     // number of errors
+    verbose,  // print additional verbiage
+    nmod,     // objects loaded
+    *pdata,   // data segment patchup pointer
+    *pbss,    // bss segment patchup pointer
+    *pfun,    // function reference (call or address) list pointer
+    *pbody,   // function body start and end offset list pointer
+    *patchdata, *patchbss, *patchfun, *patchbody; // and the lists
+
+long ts,      // text segment
+    gs;       // data segment
+
+char *cmd;
+mod_t mod[OBJ_SZ];
+def_t *ht[HASH_SZ];
+
+void *new(int size)
+{
+  void *p;
+  if ((p = sbrk((size + 7) & -8)) == (void *)-1) { dprintf(2,"%s : fatal: unable to sbrk(%d)\n", cmd, size); exit(-1); }
+  return (void *)(((long)p + 7) & -8);
+}
+
+void err(char *msg, char *name)
+{
+  dprintf(2,"%s : error: %s %s\n", cmd, msg, name);
+  if (++errs > 10) { dprintf(2,"%s : fatal: maximum errors exceeded\n", cmd); exit(-1); }
+}
+
+def_t *lookup(char *name)
+{
+  int h; char *p; def_t *d;
+  for (h = 0, p = name; *p; p++) h = h * 147 + *p;
+  for (d = ht[h & (HASH_SZ - 1)]; d; d = d->next) if (!strcmp(d->name, name)) return d;
+  d = memset(new(sizeof(def_t)), 0, sizeof(def_t));
+  d->name = name;
+  d->next = ht[h & (HASH_SZ - 1)];
+  return ht[h & (HASH_SZ - 1)] = d;
+}
+
+// read an object and append its segments and lists
+void load(char *name)
+{
+  int f, i, *p; obj_t *h; mod_t *m; struct stat st;
+
+  for (i = 0; i < nmod; i++) if (!strcmp(mod[i].name, name)) return;
+  if (nmod == OBJ_SZ) { dprintf(2,"%s : fatal: too many objects\n", cmd); exit(-1); }
+  if ((f = open(name, O_RDONLY)) < 0) { dprintf(2,"%s : fatal: can't open file %s\n", cmd, name); exit(-1); }
+  if (fstat(f, &st) || read(f, h = new(st.st_size), st.st_size) != st.st_size) { dprintf(2,"%s : fatal: can't read file %s\n", cmd, name); exit(-1); }
+  close(f);
+  if (st.st_size < sizeof(obj_t) || h->magic != OBJ_MAGIC || st.st_size != sizeof(obj_t) + h->text + h->data + h->nstr +
+    (h->npdata + h->npbss + h->npfun + h->npbody) * sizeof(int) + h->nsym * sizeof(sym_t))
+    { dprintf(2,"%s : fatal: bad object file %s\n", cmd, name); exit(-1); }
+
+  m = &mod[nmod++];
+  m->name = name;
+  m->h = h;
+  ip = (ip + 7) & -8;
+  data = (data + 7) & -8;
+  bss = (bss + 7) & -8;
+  if (ip + h->text + data + h->data + bss + h->bss > SEG_SZ) { dprintf(2,"%s : fatal: text + data + bss segment exceeds maximum size\n", cmd); exit(-1); }
+  if ((pdata - patchdata + h->npdata) * sizeof(int) > PSTACK_SZ || (pbss - patchbss + h->npbss) * sizeof(int) > PSTACK_SZ ||
+    (pfun - patchfun + h->npfun) * sizeof(int) > PSTACK_SZ || (pbody - patchbody + h->npbody) * sizeof(int) > PSTACK_SZ)
+    { dprintf(2,"%s : fatal: patch lists exceed maximum size\n", cmd); exit(-1); }
+  m->text = ip;
+  m->data = data;
+  m->bss = bss;
+  memcpy((void *)(ts + ip), h + 1, h->text);
+  memcpy((void *)(gs + data), (char *)(h + 1) + h->text, h->data);
+  p = (int *)((char *)(h + 1) + h->text + h->data);
+  m->pdata = pdata - patchdata;
+  for (i = 0; i < h->npdata; i++) *pdata++ = ip + *p++;
+  m->pbss = pbss - patchbss;
+  for (i = 0; i < h->npbss; i++) *pbss++ = ip + *p++;
+  for (i = 0; i < h->npfun; i++) *pfun++ = ip + *p++;
+  for (i = 0; i < h->npbody; i++) *pbody++ = ip + *p++;
+  m->sym = (sym_t *)p;
+  m->str = (char *)(m->sym + h->nsym);
+  m->def = new(h->nsym * sizeof(def_t *));
+  ip += h->text;
+  data += h->data;
+  bss += h->bss;
+}
+
+// pick what a name links to: a definition from outside an include file over those from one, else the first
+void define(mod_t *m, sym_t *s)
+{
+  int k, v; def_t *d;
+
+  if ((k = s->kind & 7) == OBJ_NEED) return;
+  d = m->def[s - m->sym] = lookup(m->str + s->name);
+  if (k == OBJ_EXT) return;
+  v = (k == OBJ_FUN) ? m->text + s->val : (s->val < BSS_TAG) ? m->data + s->val : m->bss + s->val;
+  if (!d->kind) { d->kind = s->kind; d->val = v; d->size = s->size; return; }
+  if ((d->kind & 7) != k) { err("function and global both named", d->name); return; }
+  if (k == OBJ_GLO && d->size != s->size) { err("conflicting sizes for global", d->name); return; }
+  if (s->kind & OBJ_WEAK) return;
+  if (d->kind & OBJ_WEAK) { d->kind = s->kind; d->val = v; }
+  else if (k == OBJ_FUN) err("duplicate definition of", d->name);
+}
+
+// the data segment offset, with bss following the data, of linked offset o
+int doff(int o) { return (o < BSS_TAG) ? o : ((data + 7) & -8) + o - BSS_TAG; }
+
+// the linked data segment offset of offset o (bss ones tagged) in object m, given the sorted ranges
+// lo to hi of its globals that are linked to another object's copy at to
+int relink(mod_t *m, int o, int n, int *lo, int *hi, int *to)
+{
+  int a, b, c;
+  for (a = 0, b = n; a < b; ) { c = (a + b) / 2; if (hi[c] <= o) a = c + 1; else b = c; }
+  return doff((a < n && lo[a] <= o) ? to[a] + o - lo[a] : (o < BSS_TAG) ? m->data + o : m->bss + o);
+}
+
+// point an object's data and bss references at the linked data segment offsets
+void globals(mod_t *m)
+{
+  int i, j, n, *lo, *hi, *to, *p, *e; sym_t *s; def_t *d;
+
+  lo = new(m->h->nsym * sizeof(int));
+  hi = new(m->h->nsym * sizeof(int));
+  to = new(m->h->nsym * sizeof(int));
+  for (n = i = 0; i < m->h->nsym; i++) {
+    s = m->sym + i;
+    if ((s->kind & 7) != OBJ_GLO) continue;
+    d = m->def[i];
+    if (d->val == ((s->val < BSS_TAG) ? m->data + s->val : m->bss + s->val)) continue;
+    for (j = n++; j && lo[j-1] > s->val; j--) { lo[j] = lo[j-1]; hi[j] = hi[j-1]; to[j] = to[j-1]; }
+    lo[j] = s->val; hi[j] = s->val + s->size; to[j] = d->val;
+  }
+  for (p = patchdata + m->pdata, e = p + m->h->npdata; p < e; p++)
+    *(int *)(ts + *p) = (*(int *)(ts + *p) & 0xff) | (relink(m, *(int *)(ts + *p) >> 8, n, lo, hi, to) << 8);
+  for (p = patchbss + m->pbss, e = p + m->h->npbss; p < e; p++)
+    *(int *)(ts + *p) = (*(int *)(ts + *p) & 0xff) | (relink(m, (*(int *)(ts + *p) >> 8) + BSS_TAG, n, lo, hi, to) << 8);
+}
+
+// index of the function body containing text offset o
+int body(int *pb, int n, int o)
+{
+  int lo, hi, m;
+  lo = 0; hi = n - 1;
+  while (lo < hi) { m = (lo + hi + 1) / 2; if (pb[m*2] <= o) lo = m; else hi = m - 1; }
+  return lo;
+}
+
+// target of the function reference at text offset o
+int target(int o) { return o + 4 + (*(int *)(ts + o) >> 8); }
+
+// the body each function body's name links to: itself, or another object's definition for an import or a
+// definition that lost
+int *functions(void)
+{
+  int i, j, nb, *to; mod_t *m; sym_t *s; def_t *d;
+
+  nb = (pbody - patchbody) / 2;
+  to = new(nb * sizeof(int));
+  for (j = 0; j < nb; j++) to[j] = j;
+  for (m = mod; m < mod + nmod; m++) {
+    for (i = 0; i < m->h->nsym; i++) {
+      s = m->sym + i;
+      if ((s->kind & 7) != OBJ_FUN && s->kind != OBJ_EXT) continue;
+      d = m->def[i];
+      if ((d->kind & 7) != OBJ_FUN) { err("undefined function", d->name); continue; }
+      to[body(patchbody, nb, m->text + s->val)] = body(patchbody, nb, d->val);
+    }
+  }
+  return to;
+}
+
+// drop the function bodies not reachable from main and return the new text size.  function references
+// go to the start of the body that link[] gives for the one they were compiled against
+int prune(int *link, int *amain)
+{
+  int i, j, n, nb, nr, o, r, *live, *first, *tb, *to, *work, *pb, *pf, *p, *q, *e;
+
+  pb = patchbody; pf = patchfun;
+  nb = (pbody - pb) / 2;
+  nr = pfun - pf;
+  live  = memset(new(nb * sizeof(int)), 0, nb * sizeof(int));
+  first = new((nb + 1) * sizeof(int));
+  tb    = new(nr * sizeof(int));
+  to    = new(nb * sizeof(int));
+  work  = new(nb * sizeof(int));
+
+  // references are recorded in text order, so each body's are a run of the list
+  for (r = i = 0; i < nb; i++) { while (r < nr && pf[r] < pb[i*2]) r++; first[i] = r; }
+  first[nb] = nr;
+
+  // mark everything reachable from main through calls and taken addresses
+  live[work[0] = body(pb, nb, *amain)] = 1;
+  for (n = 1; n; ) {
+    i = work[--n];
+    for (r = first[i]; r < first[i+1]; r++)
+      if (!live[j = tb[r] = link[body(pb, nb, target(pf[r]))]]) { live[j] = 1; work[n++] = j; }
+  }
+
+  // lay out the live bodies, then fix their references and move them down
+  for (o = n = i = 0; i < nb; i++) if (live[i]) { to[i] = o; o += pb[i*2+1] - pb[i*2]; n++; }
+  if (verbose) dprintf(2,"%s : %d of %d functions live, text %d -> %d\n", cmd, n, nb, ip, o);
+  for (i = 0; i < nb; i++) {
+    if (!live[i]) continue;
+    for (r = first[i]; r < first[i+1]; r++)
+      *(int *)(ts + pf[r]) = (*(int *)(ts + pf[r]) & 0xff) | ((to[tb[r]] - (to[i] + pf[r] - pb[i*2]) - 4) << 8);
+    for (p = (int *)(ts + pb[i*2]), e = (int *)(ts + pb[i*2+1]), q = (int *)(ts + to[i]); p < e; ) *q++ = *p++;
+  }
+
+  // remap the data and bss patch lists, dropping those in dead code.  they are in text order too
+  for (p = q = patchdata, i = 0; p < pdata; p++) { while (i < nb - 1 && pb[i*2+2] <= *p) i++; if (live[i]) *q++ = *p - pb[i*2] + to[i]; }
+  pdata = q;
+  for (p = q = patchbss, i = 0; p < pbss; p++) { while (i < nb - 1 && pb[i*2+2] <= *p) i++; if (live[i]) *q++ = *p - pb[i*2] + to[i]; }
+  pbss = q;
+
+  i = body(pb, nb, *amain);
+  *amain += to[i] - pb[i*2];
+  return o;
+}
+
+int main(int argc, char *argv[])
+{
+  int i, f, text, amain, *link; char *outfile; mod_t *m; def_t *d, *x;
+  struct { uint magic, bss, entry, flags; } hdr;
+
+  cmd = *argv;
+  outfile = 0;
+  while (--argc && **++argv == '-') {
+    switch ((*argv)[1]) {
+    case 'v': verbose = 1; continue;
+    case 'o': if (argc > 1) { outfile = *++argv; argc--; continue; }
+    }
+    goto usage;
+  }
+  if (!outfile || !argc) { usage: dprintf(2,"usage: %s [-v] -o exefile file.o ...\n", cmd); return -1; }
+
+  ts = (long) new(SEG_SZ);
+  gs = (long) new(SEG_SZ);
+  pdata = patchdata = new(PSTACK_SZ);
+  pbss  = patchbss  = new(PSTACK_SZ);
+  pfun  = patchfun  = new(PSTACK_SZ);
+  pbody = patchbody = new(PSTACK_SZ);
+
+  // the named objects, then the ones they took function bodies from
+  while (argc--) load(*argv++);
+  for (m = mod; m < mod + nmod; m++)
+    for (i = 0; i < m->h->nsym; i++) if (m->sym[i].kind == OBJ_NEED) load(m->str + m->sym[i].name);
+  if (verbose) dprintf(2,"%s : %d objects, text = %d data = %d bss = %d\n", cmd, nmod, ip, data, bss);
+
+  for (m = mod; m < mod + nmod; m++) for (i = 0; i < m->h->nsym; i++) define(m, m->sym + i);
+  if (((d = lookup("main"))->kind & 7) != OBJ_FUN) err("undefined function", "main");
+  if (((x = lookup("xstart"))->kind & 7) == OBJ_FUN) d = x; // libc.h xstart() calls main and exits through exit()
+  if (errs) return -1;
+  for (m = mod; m < mod + nmod; m++) globals(m);
+  link = functions();
+  if (errs) return -1;
+
+  amain = d->val;
+  ip = prune(link, &amain);
+  ip = (ip + 7) & -8;
+  text = ip;
+  data = (data + 7) & -8;
+  bss = (bss + 7) & -8;
+  while (pdata != patchdata) { pdata--; *(int *)(ts + *pdata) += (ip - *pdata - 4) << 8; }
+  while (pbss  != patchbss ) { pbss--;  *(int *)(ts + *pbss)  += (ip - *pbss  - 4) << 8; } // bss offsets already follow the data
+
+  if ((f = open(outfile, O_WRONLY | O_CREAT | O_TRUNC)) < 0) { dprintf(2,"%s : error: can't open output file %s\n", cmd, outfile); return -1; }
+  hdr.magic = 0xC0DEF00D;
+  hdr.bss   = bss;
+  hdr.entry = amain;
+  hdr.flags = 0;
+  write(f, &hdr, sizeof(hdr));
+  write(f, (void *)ts, text);
+  write(f, (void *)gs, data);
+  close(f);
+  if (verbose) dprintf(2,"%s : entry = %d text = %d data = %d bss = %d\n", cmd, amain, text, data, bss);
+  return 0;
+}
@@ -7,6 +7,7 @@
 
 #include <u.h>
 #include <libc.h>
+#include <mem.h>
 
 // Parsed command representation
 enum { EXEC = 1, REDIR, PIPE, LIST, BACK };
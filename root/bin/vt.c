@@ -4,6 +4,7 @@
 
 #include <u.h>
 #include <libc.h>
+#include <mem.h>
 #include <net.h>
 #include <gl.h>
 #include <font.h>
@@ -2,27 +2,26 @@
 
 #include <u.h>
 #include <libc.h>
+#include <file.h>
 
-void wc(int fd, char *name)
+void wc(FILE *f, char *name)
 {
-  int i, n, l, w, c, inword; char buf[512];
+  int ch, l, w, c, inword;
 
   l = w = c = 0;
   inword = 0;
-  while ((n = read(fd, buf, sizeof(buf))) > 0) {
-    for (i=0; i<n; i++) {
-      c++;
-      if (buf[i] == '\n')
-        l++;
-      if (strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if (!inword) {
-        w++;
-        inword = 1;
-      }
+  while ((ch = getc(f)) != EOF) {
+    c++;
+    if (ch == '\n')
+      l++;
+    if (ch <= ' ' && strchr(" \r\t\n\v", ch))
+      inword = 0;
+    else if (!inword) {
+      w++;
+      inword = 1;
     }
   }
-  if (n < 0) {
+  if (ferror(f)) {
     dprintf(2,"wc: read error\n");
     exit(0);
   }
@@ -31,17 +30,17 @@ void wc(int fd, char *name)
 
 int main(int argc, char *argv[])
 {
-  int fd, i;
+  int i; FILE *f;
 
-  if (argc <= 1) { wc(0, ""); return 0; }
+  if (argc <= 1) { wc(stdin, ""); return 0; }
 
   for (i = 1; i < argc; i++) {
-    if( (fd = open(argv[i], 0)) < 0) {
+    if (!(f = fopen(argv[i], "r"))) {
       dprintf(2,"wc: cannot open %s\n", argv[i]);
       return -1;
     }
-    wc(fd, argv[i]);
-    close(fd);
+    wc(f, argv[i]);
+    fclose(f);
   }
   return 0;
 }
@@ -17,7 +17,8 @@ struct dinode {          // 4K disk inode structure
   ushort mode;           // file mode
   uint nlink;            // number of links to inode in file system
   uint size;             // size of file
-  uint pad[17];
+  uint gen;              // generation
+  uint pad[16];
   uint dir[NDIR];        // data block addresses
   uint idir[NIDIR];      // 2 GB max file size
   uint iidir[NIIDIR];    // not yet implemented
@@ -5,6 +5,8 @@ enum {
   PAGE    = 4096,       // page size
   NPROC   = 64,         // maximum number of processes
   NOFILE  = 16,         // open files per process
+  NVMA    = 16,         // memory mappings per process
+  NSOCKQ  = 16,         // socket wait queues, hashed by host socket
   NFILE   = 100,        // open files per system
   NBUF    = 10,         // size of disk block cache
   NINODE  = 50,         // maximum number of active i-nodes  XXX make this more dynamic ...
@@ -15,6 +17,8 @@ enum {
   FSSIZE  = PAGE*1024,  // XXX
   MAXARG  = 256,        // max exec arguments
   STACKSZ = 0x800000,   // user stack size (8MB)
+  TICK    = 128*1024,   // scheduling time slice (cycles)
+  MSEC    = 100*1000,   // nominal cycles per millisecond
 };
 
 enum { // page table entry flags   XXX refactor vs. i386
@@ -36,7 +40,8 @@ enum { // processor fault codes
   FIPAGE, // page fault on opcode fetch
   FWPAGE, // page fault on write
   FRPAGE, // page fault on read
-  USER=16 // user mode exception
+  USER=16,// user mode exception
+  FNET=32 // network interrupt (a bit of its own so it can pend with FTIMER and FKEYBD)
 };
 
 struct trapframe { // layout of the trap frame built on the stack by trap handler
@@ -67,6 +72,7 @@ enum { S_IFIFO = 0x1000, // fifo
        S_IFREG = 0x8000, // regular
        S_IFMT  = 0xF000 }; // file type mask
 enum { O_RDONLY, O_WRONLY, O_RDWR, O_CREAT = 0x100, O_TRUNC = 0x200 };
+enum { PROT_READ = 1, PROT_WRITE = 2, MAP_SHARED = 1, MAP_PRIVATE = 2, MAP_ANON = 0x20 };
 enum { SEEK_SET, SEEK_CUR, SEEK_END };
 
 struct stat {
@@ -75,6 +81,7 @@ struct stat {
   uint   st_ino;         // inode number on device
   uint   st_nlink;       // number of links to file
   uint   st_size;        // size of file in bytes
+  uint   st_gen;         // file generation (changes whenever the contents may have)
 };
 
 // disk file system format
@@ -85,14 +92,16 @@ enum {
   NIIDIR   = 8,
   NIIIDIR  = 4,
   DIRSIZ   = 252,
-  PIPESIZE = 4000,       // XXX up to a page (since pipe is a page)
+  PIPEPGS  = 4,          // pipe buffer pages (power of 2)
+  PIPESIZE = PIPEPGS*PAGE,
 };
 
 struct dinode { // on-disk inode structure
   ushort mode;           // file mode
   uint nlink;            // number of links to inode in file system
   uint size;             // size of file
-  uint pad[17];
+  uint gen;              // generation, bumped whenever the file is opened for writing and when it is closed again
+  uint pad[16];
   uint dir[NDIR];        // data block addresses
   uint idir[NIDIR];
   uint iidir[NIIDIR];    // XXX not implemented
@@ -104,12 +113,20 @@ struct direct { // directory is a file containing a sequence of direct structure
   char d_name[DIRSIZ];
 };
 
+struct pollent { // a poll() waiter, linked onto the wait queue of each pipe, console or socket it watches
+  struct pollent *next;
+  void *chan;            // where the poller sleeps
+};
+
 struct pipe {
-  char data[PIPESIZE];
+  char *data[PIPEPGS];   // ring buffer pages
   uint nread;            // number of bytes read
   uint nwrite;           // number of bytes written
   int readopen;          // read fd is still open
   int writeopen;         // write fd is still open
+  char rwait;            // reader sleeping on empty
+  char wwait;            // writer sleeping on full
+  struct pollent *pollq; // pollers waiting for input
 };
 
 struct inode { // in-memory copy of an inode
@@ -119,6 +136,7 @@ struct inode { // in-memory copy of an inode
   ushort mode;           // copy of disk inode
   uint nlink;
   uint size;
+  uint gen;
   uint dir[NDIR];
   uint idir[NIDIR];
 };
@@ -134,6 +152,13 @@ struct file {
   uint off;
 };
 
+struct vma { // memory mapping, faulted in a page at a time
+  uint start, end;       // user address range, page aligned (end is 0 if unused)
+  uint off;              // file offset of start
+  int prot, flags;       // PROT_* and MAP_*
+  struct inode *ip;      // mapped file, 0 if anonymous
+};
+
 enum { I_BUSY = 1, I_VALID = 2 };
 enum { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
@@ -149,9 +174,12 @@ struct proc { // per-process state
   struct trapframe *tf;  // trap frame for current syscall
   int context;           // swtch() here to run process
   void *chan;            // if non-zero, sleeping on chan
+  uint timeout;          // if on timer queue, cycle count to wake up at
+  struct proc *tnext;    // next process on timer queue
   int killed;            // if non-zero, have been killed
   struct file *ofile[NOFILE]; // open files
   struct inode *cwd;     // current directory
+  struct vma vma[NVMA];  // memory mappings above sz
   char name[16];         // process name (debugging)
 };
 
@@ -167,6 +195,7 @@ struct input_s {
   char buf[INPUT_BUF];
   uint r;  // read index
   uint w;  // write index
+  struct pollent *pollq; // pollers waiting for input
 };
 
 enum { PF_INET = 2, AF_INET = 2, SOCK_STREAM = 1, INADDR_ANY = 0 }; // XXX keep or chuck these?
@@ -183,12 +212,15 @@ uint kreserved;          // start of kernel reserved memory heap
 struct devsw devsw[NDEV];
 uint *kpdir;             // kernel page directory
 uint ticks;
+uint tickcyc;            // cycle count at last tick
+struct proc *timerq;     // processes with a wakeup deadline, soonest first
 char *memdisk;
 struct input_s input;    // XXX do this some other way?
 struct buf bcache[NBUF];
 struct buf bfreelist;    // linked list of all buffers, through prev/next.   bfreelist.next is most recently used
 struct inode inode[NINODE]; // inode cache XXX make dynamic and eventually power of 2, look into iget()
 struct file file[NFILE];
+struct pollent *sockq[NSOCKQ]; // pollers waiting on host sockets, blocked readers sleep on the queue itself
 int nextpid;
 
 rfsd = -1; // XXX will be set on mount, XXX total redesign?
@@ -204,7 +236,8 @@ out(port, val)  { asm(LL,8); asm(LBL,16); asm(BOUT); }
 ivec(void *isr) { asm(LL,8); asm(IVEC); }
 lvadr()         { asm(LVAD); }
 uint msiz()     { asm(MSIZ); }
-stmr(val)       { asm(LL,8); asm(TIME); }
+stmr(val)       { asm(LL,8); asm(TIME,1); } // one-shot
+uint cyc()      { asm(CYC); }
 pdir(val)       { asm(LL,8); asm(PDIR); }
 spage(val)      { asm(LL,8); asm(SPAG); }
 splhi()         { asm(CLI); }
@@ -293,6 +326,7 @@ consoleintr()
     if (input.w - input.r < INPUT_BUF) {
       input.buf[input.w++ % INPUT_BUF] = c;
       wakeup(&input.r);
+      pollwake(input.pollq);
     }
   }
 }
@@ -593,6 +627,7 @@ iupdate(struct inode *ip)
   dip->mode  = ip->mode;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->gen = ip->gen;
 //  printf("iupdate() memcpy(dip->dir, ip->dir, %d)\n",sizeof(ip->dir));
   memcpy(dip->dir, ip->dir, sizeof(ip->dir));
   memcpy(dip->idir, ip->idir, sizeof(ip->idir));
@@ -627,6 +662,7 @@ ilock(struct inode *ip)
     ip->mode  = dip->mode;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->gen = dip->gen;
     memcpy(ip->dir,  dip->dir,  sizeof(ip->dir));
     memcpy(ip->idir, dip->idir, sizeof(ip->idir));
     brelse(bp);
@@ -745,6 +781,7 @@ stati(struct inode *ip, struct stat *st)
   st->st_ino   = ip->inum;
   st->st_nlink = ip->nlink;
   st->st_size  = ip->size;
+  st->st_gen   = ip->gen;
 }
 
 // read data from inode
@@ -942,54 +979,80 @@ struct inode *nameiparent(char *path, char *name)
 // pipes:
 void pipeclose(struct pipe *p, int writable)
 {
-  int e = splhi();
+  int i, e = splhi();
   if (writable) {
     p->writeopen = 0;
     wakeup(&p->nread);
+    pollwake(p->pollq);
   } else {
     p->readopen = 0;
     wakeup(&p->nwrite);
   }
-  if (!p->readopen && !p->writeopen) kfree(p);
+  if (!p->readopen && !p->writeopen) {
+    for (i = 0; i < PIPEPGS; i++) kfree(p->data[i]);
+    kfree(p);
+  }
   splx(e);
 }
 
+// fault in the user pages of [a, a+n) so they can be copied with interrupts off
+touch(char *a, int n)
+{
+  uint v, e; char c;
+  if (n <= 0) return;
+  for (v = (uint)a & -PAGE, e = (uint)a + n; v < e; v += PAGE) c = *(char *)v;
+}
+
 int pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i, e = splhi();
+  int i, m, o, e;
 
-  for (i = 0; i < n; i++) {
+  touch(addr, n);
+  e = splhi();
+  for (i = 0; i < n; i += m) {
     while (p->nwrite == p->nread + PIPESIZE) {  // XXX DOC: pipewrite-full
       if (!p->readopen || u->killed) {
         splx(e);
         return -1;
       }
-      wakeup(&p->nread);
+      if (p->rwait) { p->rwait = 0; wakeup(&p->nread); }
+      p->wwait = 1;
       sleep(&p->nwrite);  // XXX DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i]; // XXX pagefault possible in cli (use inode locks instead?)
-  }
-  wakeup(&p->nread);  // XXX DOC: pipewrite-wakeup
+    o = p->nwrite % PIPESIZE; // copy up to the end of the page, free space, or request
+    if ((m = PAGE - o % PAGE) > n - i) m = n - i;
+    if (m > p->nread + PIPESIZE - p->nwrite) m = p->nread + PIPESIZE - p->nwrite;
+    memcpy(p->data[o / PAGE] + o % PAGE, addr + i, m);
+    p->nwrite += m;
+  }
+  if (p->rwait) { p->rwait = 0; wakeup(&p->nread); }  // XXX DOC: pipewrite-wakeup
+  pollwake(p->pollq);
   splx(e);
   return n;
 }
 
 int piperead(struct pipe *p, char *addr, int n)
 {
-  int i, e = splhi();
+  int i, m, o, e;
 
+  touch(addr, n < PIPESIZE ? n : PIPESIZE);
+  e = splhi();
   while (p->nread == p->nwrite && p->writeopen) {  // XXX DOC: pipe-empty
     if (u->killed) {
       splx(e);
       return -1;
     }
+    p->rwait = 1;
     sleep(&p->nread); // XXX DOC: piperead-sleep
   }
-  for (i = 0; i < n; i++) {  // XXX DOC: piperead-copy
-    if (p->nread == p->nwrite) break;
-    addr[i] = p->data[p->nread++ % PIPESIZE]; // XXX pagefault possible in cli (use inode locks instead?)
+  for (i = 0; i < n && p->nread != p->nwrite; i += m) {  // XXX DOC: piperead-copy
+    o = p->nread % PIPESIZE;
+    if ((m = PAGE - o % PAGE) > n - i) m = n - i;
+    if (m > p->nwrite - p->nread) m = p->nwrite - p->nread;
+    memcpy(addr + i, p->data[o / PAGE] + o % PAGE, m);
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  // XXX DOC: piperead-wakeup
+  if (p->wwait && p->nwrite - p->nread <= PIPESIZE / 2) { p->wwait = 0; wakeup(&p->nwrite); } // let the writer refill in bulk XXX DOC: piperead-wakeup
   splx(e);
   return i;
 }
@@ -1074,8 +1137,10 @@ struct inode *create(char *path, ushort mode, int dev)
 }
 
 // *** syscalls ***
-int svalid(uint s) { return (s < u->sz) && memchr(s, 0, u->sz - s); }
-int mvalid(uint a, int n) { return a <= u->sz && a+n <= u->sz; }
+struct vma *vmfind(uint a) { struct vma *v; for (v = u->vma; v < &u->vma[NVMA]; v++) if (a >= v->start && a < v->end) return v; return 0; }
+int svalid(uint s) { struct vma *v; return ((s < u->sz) && memchr(s, 0, u->sz - s)) || ((v = vmfind(s)) && memchr(s, 0, v->end - s)); }
+// user memory a..a+n is there to read, or with w set to write
+int mvalid(uint a, int n, int w) { struct vma *v; return (a <= u->sz && a+n <= u->sz) || (n >= 0 && (v = vmfind(a)) && a+n <= v->end && (v->prot & (w ? PROT_WRITE : PROT_READ | PROT_WRITE))); }
 struct file *getf(uint fd) { return (fd < NOFILE) ? u->ofile[fd] : 0; }
 
 int sockopen(int family, int type, int protocol) { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(NET1); }
@@ -1084,8 +1149,25 @@ int sockconnect(int fd, uint family_port, uint addr) { asm(LL, 8); asm(LBL,16);
 int sockread (int sd, char *addr, int n) { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(NET4); }
 int sockwrite(int sd, char *addr, int n) { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(NET5); }
 int sockpoll(int sd) { asm(LL, 8); asm(NET6); }
+int sockarm(int sd) { asm(LL, 8); asm(NET6,1); } // like sockpoll, but if not ready the emulator raises FNET once it is
+int sockready() { asm(NET6,2); } // next armed socket found ready, or -1
 enum { M_OPEN, M_CLOSE, M_READ, M_WRITE, M_SEEK, M_FSTAT, M_SYNC };
 
+// block until host socket sd has input or a connection to accept
+int sockwait(int sd)
+{
+  int e = splhi();
+  while (!sockarm(sd)) {
+    if (u->killed) {
+      splx(e);
+      return -1;
+    }
+    sleep(&sockq[sd % NSOCKQ]);
+  }
+  splx(e);
+  return 0;
+}
+
 int socktx(int sd, void *p, int n)
 {
   int r;
@@ -1096,15 +1178,11 @@ int socktx(int sd, void *p, int n)
   }
   return 0;
 }
-// int cyc() { asm(CYC); } XXX
-int sockrx(int sd, void *p, int n) // XXX this is always going to be slow until I fix the sockpoll (since ssleep waits for a comparitively long time (timer vs. em delta))
+int sockrx(int sd, void *p, int n)
 {
-  int r; // uint cy, nyc;
+  int r;
   while (n > 0) {
-    while (!sockpoll(sd)) ssleep(1); // XXX needs to block properly XXX should I lock the inode?
-//    while (!sockpoll(sd)) { printf("x"); ssleep(1); } // XXX needs to block properly XXX should I lock the inode?
-//    while (!sockpoll(sd)) { cy = cyc(); for (r = 0; r < 10; r++) { nyc = cyc(); printf("[%d]",nyc - cy); cy = nyc; ssleep(100); } } // XXX needs to block properly XXX should I lock the inode?
-//    while (!sockpoll(sd)) { cy = cyc(); for (r = 0; r < 10; r++) { nyc = cyc(); printf("[%d]",nyc - cy); cy = nyc; ssleep(1); } } // XXX needs to block properly XXX should I lock the inode?
+    if (sockwait(sd)) return -1; // XXX should I lock the inode?
     if ((r = sockread(sd, p, n)) <= 0) { printf("sockrx() sockread()\n"); return -1; } //  XXX <= 0?
     n -= r;
     p += r;
@@ -1128,7 +1206,10 @@ fileclose(struct file *f)
 
   switch (ff.type) {
   case FD_PIPE:   pipeclose(ff.pipe, ff.writable); break;
-  case FD_INODE:  iput(ff.ip); break;
+  case FD_INODE:
+    if (ff.writable && (ff.ip->mode & S_IFMT) == S_IFREG) { ilock(ff.ip); ff.ip->gen++; iupdate(ff.ip); iunlock(ff.ip); }
+    iput(ff.ip);
+    break;
   case FD_SOCKET:
   case FD_RFS:    sockclose(ff.off);
   }
@@ -1146,7 +1227,7 @@ int close(int fd)
 int fstat(int fd, struct stat *st)
 {
   int r; struct file *f;
-  if (!(f = getf(fd)) || !mvalid(st, sizeof(struct stat))) return -1;
+  if (!(f = getf(fd)) || !mvalid(st, sizeof(struct stat), 1)) return -1;
   switch (f->type) {
   case FD_INODE:
     ilock(f->ip);
@@ -1164,13 +1245,14 @@ int fstat(int fd, struct stat *st)
 int read(int fd, char *addr, int n)
 {
   int r; int h[2]; struct file *f;
-  if (!(f = getf(fd)) || !f->readable || !mvalid(addr, n)) return -1;
+  if (!(f = getf(fd)) || !f->readable || !mvalid(addr, n, 1)) return -1;
   switch (f->type) {
   case FD_PIPE: return piperead(f->pipe, addr, n);
   case FD_SOCKET:
-    while (!sockpoll(f->off)) ssleep(1); // XXX needs to block properly XXX should I lock the inode? (right now there isn't an inode!)
+    if (sockwait(f->off)) return -1; // XXX should I lock the inode? (right now there isn't an inode!)
     return sockread(f->off, addr, n);
   case FD_INODE:
+    if ((uint)addr + n > u->sz) touch(addr, n); // fault mapped pages in before the buffer cache is held
     ilock(f->ip);
     if ((r = readi(f->ip, addr, f->off, n)) > 0) f->off += r;
     iunlock(f->ip);
@@ -1186,11 +1268,12 @@ int read(int fd, char *addr, int n)
 int write(int fd, char *addr, int n)
 {
   int r, h[2]; struct file *f;
-  if (!(f = getf(fd)) || !f->writable || !mvalid(addr, n)) return -1;
+  if (!(f = getf(fd)) || !f->writable || !mvalid(addr, n, 0)) return -1;
   switch (f->type) {
   case FD_PIPE: return pipewrite(f->pipe, addr, n);
   case FD_SOCKET: return sockwrite(f->off, addr, n); // XXX needs to block
   case FD_INODE:
+    if ((uint)addr + n > u->sz) touch(addr, n);
     ilock(f->ip);
     if ((r = writei(f->ip, addr, f->off, n)) > 0) f->off += r;
     iunlock(f->ip);
@@ -1204,6 +1287,34 @@ int write(int fd, char *addr, int n)
   panic("write");
 }
 
+// copy up to n bytes from file in into a pipe or socket a block at a time.  each block is copied out of the
+// buffer cache first, so neither it nor the inode is held while the write sleeps
+int sendfile(int out, int in, int n)
+{
+  int r, m, tot; struct file *fi, *fo; struct inode *ip; struct buf *bp; char *kb;
+  if (!(fi = getf(in)) || !fi->readable || fi->type != FD_INODE ||
+      !(fo = getf(out)) || !fo->writable || (fo->type != FD_PIPE && fo->type != FD_SOCKET)) return -1;
+  ip = fi->ip;
+  ilock(ip);
+  if ((ip->mode & S_IFMT) == S_IFCHR) { iunlock(ip); return -1; }
+  iunlock(ip);
+  if (n < 0 || !(kb = kalloc())) return -1;
+  for (r = tot = 0; tot < n; tot += m) {
+    ilock(ip);
+    if (fi->off >= ip->size) { iunlock(ip); break; }
+    if ((m = PAGE - fi->off % PAGE) > n - tot) m = n - tot;
+    if (m > ip->size - fi->off) m = ip->size - fi->off;
+    bp = bread(bmap(ip, fi->off / PAGE));
+    memcpy(kb, bp->data + fi->off % PAGE, m);
+    brelse(bp);
+    iunlock(ip);
+    if ((r = (fo->type == FD_PIPE) ? pipewrite(fo->pipe, kb, m) : socktx(fo->off, kb, m)) < 0) break;
+    fi->off += m;
+  }
+  kfree(kb);
+  return tot ? tot : r;
+}
+
 int lseek(int fd, int offset, uint whence)
 {
   int r, h[3]; struct file *f;
@@ -1346,6 +1457,10 @@ int open(char *path, int oflag) // XXX, int mode)
 
   if (oflag & O_TRUNC)
     itrunc(ip);
+  if ((oflag & (O_WRONLY | O_RDWR)) && (ip->mode & S_IFMT) == S_IFREG) {
+    ip->gen++;
+    iupdate(ip);
+  }
 
   iunlock(ip);
 
@@ -1393,11 +1508,22 @@ int pipe(int *fd)
 {
   struct pipe *p;
   struct file *rf, *wf;
-  int fd0, fd1;
+  int fd0, fd1, i;
 
-  if (!mvalid(fd, 8) || !(rf = filealloc())) return -1;
+  if (!mvalid(fd, 8, 1) || !(rf = filealloc())) return -1;
   if (!(wf = filealloc())) { fileclose(rf); return -1; }
-  p = (struct pipe *)kalloc();
+  if (!(p = (struct pipe *)kalloc())) { fileclose(rf); fileclose(wf); return -1; }
+  for (i = 0; i < PIPEPGS; i++) {
+    if (!(p->data[i] = kalloc())) {
+      while (i--) kfree(p->data[i]);
+      kfree((char *)p);
+      fileclose(rf);
+      fileclose(wf);
+      return -1;
+    }
+  }
+  p->rwait = p->wwait = 0;
+  p->pollq = 0;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -1434,7 +1560,7 @@ int exec(char *path, char **argv)
 
   if (!svalid(path)) return -1;
   for (argc = 0; ; argc++) {
-    if (argc >= MAXARG || !mvalid(argv + argc, 4)) return -1;
+    if (argc >= MAXARG || !mvalid(argv + argc, 4, 0)) return -1;
     if (!argv[argc]) break;
     if (!svalid(argv[argc])) return -1;
   }
@@ -1447,7 +1573,7 @@ int exec(char *path, char **argv)
     if (!namei(cpath)) return -1;
     if (!(ip = namei(path = "/bin/c"))) return -1;
     argv++;
-    argc++;
+    argc += 2;
   }
   ilock(ip);
   pd = 0;
@@ -1482,7 +1608,7 @@ int exec(char *path, char **argv)
   // prepare stack arguments
   stack = sp += PAGE - (argc+1)*4;
   for (i=0; i<argc; i++) {
-    s = (!c || i > 1) ? *argv++ : (i ? cpath : path);
+    s = (!c || i > 2) ? *argv++ : (i == 2 ? cpath : i ? "-C/usr/cache" : path); // run c with its compiled-binary cache
     n = strlen(s) + 1;
     if ((sp & (PAGE - 1)) < n) goto bad;
     sp -= n;
@@ -1508,6 +1634,7 @@ bad:
   safestrcpy(u->name, last, sizeof(u->name));
 
   // commit to the user image
+  munmap(0, USERTOP);
   oldpd = u->pdir;
   u->pdir = pd;
   u->sz = sz + PAGE;
@@ -1525,10 +1652,19 @@ uint *copyuvm(uint *pd, uint sz);
 int fork()
 {
   int i, pid;
-  struct proc *np;
+  uint va, *pte;
+  struct proc *np; struct vma *v;
 
   if (!(np = allocproc())) return -1;
   np->pdir = copyuvm(u->pdir, u->sz); // copy process state
+  for (i = 0; i < NVMA; i++) { // copy mappings and the pages faulted in so far
+    if (!(v = &u->vma[i])->end) continue;
+    memcpy(&np->vma[i], v, sizeof(struct vma));
+    if (v->ip) idup(v->ip);
+    for (va = v->start; va < v->end; va += PAGE)
+      if ((pte = walkpdir(u->pdir, va)) && (*pte & PTE_P))
+        mappage(np->pdir, va, V2P+(memcpy(kalloc(), P2V+(*pte & -PAGE), PAGE)), *pte & (PAGE-1)); // XXX shared mappings are copied too
+  }
   np->sz = u->sz;
   np->parent = u;
   memcpy(np->tf, u->tf, sizeof(struct trapframe));
@@ -1552,6 +1688,8 @@ exit(int rc)
   if (u->pid == 0) { for (;;) asm(IDLE); } // spin in the arms of the kernel (cant be paged out)
   else if (u->pid == 1) panic("exit() init exiting"); // XXX reboot after all processes go away?
 
+  munmap(0, USERTOP);
+
   // close all open files
   for (fd = 0; fd < NOFILE; fd++) {
     if (u->ofile[fd]) {
@@ -1639,10 +1777,11 @@ int wait()
 // grow process by n bytes             XXX need to verify that u->sz is always at a 4 byte alignment  !!!!!
 int sbrk(int n)
 {
-  uint osz, sz;
+  uint osz, sz; struct vma *v;
   if (!n) return u->sz;
   osz = sz = u->sz;
   if (n > 0) {
+    for (v = u->vma; v < &u->vma[NVMA]; v++) if (v->end && sz + n > v->start) return -1; // don't grow into a mapping
 //    printf("growproc(%d)\n",n);
     if (!(sz = allocuvm(u->pdir, sz, sz + n, 0))) {
       printf("bad growproc!!\n"); //XXX
@@ -1663,17 +1802,114 @@ int sbrk(int n)
   return osz;
 }
 
+// map len bytes of a file (or zeroed memory if MAP_ANON) below the lowest mapping that leaves room.  args are addr, len, prot, flags, fd, off
+uint mmap(uint *a)
+{
+  uint len, s; struct vma *v, *w; struct file *f; struct inode *ip;
+
+  if (!mvalid(a, 48, 0) || !(len = (a[2] + PAGE-1) & -PAGE) || a[10] % PAGE || !(a[6] & (MAP_SHARED | MAP_PRIVATE))) return -1;
+  ip = 0;
+  if (!(a[6] & MAP_ANON)) {
+    if (!(f = getf(a[8])) || f->type != FD_INODE || !f->readable || (f->ip->mode & S_IFMT) != S_IFREG) return -1;
+    if ((a[6] & MAP_SHARED) && (a[4] & PROT_WRITE) && !f->writable) return -1;
+    ip = f->ip;
+  }
+  for (v = u->vma; v->end; ) if (++v == &u->vma[NVMA]) return -1;
+  for (s = USERTOP - len; ; s = w->start - len) { // XXX addr hint ignored
+    if (s < u->sz || s > USERTOP - len) return -1;
+    for (w = u->vma; w < &u->vma[NVMA] && (s >= w->end || s + len <= w->start); w++) ;
+    if (w == &u->vma[NVMA]) break;
+  }
+  v->start = s;
+  v->end = s + len;
+  v->off = a[10];
+  v->prot = a[4];
+  v->flags = a[6];
+  if (v->ip = ip) idup(ip);
+  return s;
+}
+
+// fault in the page of a mapping at va.  returns 0 if va is unmapped or the page is already present (write to a read-only mapping)
+int vmfault(uint va)
+{
+  struct vma *v; uint *pte; char *p;
+
+  if (!(v = vmfind(va)) || ((pte = walkpdir(u->pdir, va)) && (*pte & PTE_P))) return 0;
+  va &= -PAGE;
+  p = memset(kalloc(), 0, PAGE);
+  if (v->ip) readi(v->ip, p, v->off + va - v->start, PAGE); // past end of file stays zero
+  mappage(u->pdir, va, V2P+p, (v->prot & PROT_WRITE) ? PTE_P | PTE_W | PTE_U : PTE_P | PTE_U);
+  return 1;
+}
+
+// free the pages of v in [s, e), writing dirty pages of a shared file mapping back first (never past the end of the file)
+vmdrop(struct vma *v, uint s, uint e)
+{
+  uint va, o, n, *pte; int sync;
+
+  if (sync = v->ip && (v->flags & MAP_SHARED)) ilock(v->ip);
+  for (va = s; va < e; va += PAGE, pte++) {
+    if ((va == s || !(va & (PAGE * 1024 - 1))) && !(pte = walkpdir(u->pdir, va))) { va = ((va + PAGE * 1024) & -(PAGE * 1024)) - PAGE; continue; } // no page table for this 4M
+    if (!(*pte & PTE_P)) continue;
+    if (sync && (*pte & PTE_D) && (o = v->off + va - v->start) < v->ip->size) {
+      if ((n = v->ip->size - o) > PAGE) n = PAGE;
+      writei(v->ip, P2V+(*pte & -PAGE), o, n);
+      sync = 2;
+    }
+    kfree(P2V+(*pte & -PAGE));
+    *pte = 0;
+  }
+  if (sync == 2) { v->ip->gen++; iupdate(v->ip); }
+  if (sync) iunlock(v->ip);
+}
+
+int munmap(uint a, uint n)
+{
+  uint e; struct vma *v, *w;
+
+  if (a % PAGE || (e = a + ((n + PAGE-1) & -PAGE)) < a) return -1;
+  for (v = u->vma; v < &u->vma[NVMA]; v++) {
+    if (!v->end || e <= v->start || a >= v->end) continue;
+    if (a > v->start && e < v->end) { // punch a hole, splitting the mapping in two
+      for (w = u->vma; w->end; ) if (++w == &u->vma[NVMA]) return -1;
+      memcpy(w, v, sizeof(struct vma));
+      w->off += e - v->start;
+      w->start = e;
+      if (w->ip) idup(w->ip);
+      vmdrop(v, a, e);
+      v->end = a;
+    }
+    else if (a > v->start) { vmdrop(v, a, v->end); v->end = a; }
+    else if (e < v->end) { vmdrop(v, v->start, e); v->off += e - v->start; v->start = e; }
+    else {
+      vmdrop(v, v->start, v->end);
+      if (v->ip) iput(v->ip);
+      v->ip = 0;
+      v->start = v->end = 0;
+    }
+  }
+  pdir(V2P+(uint)(u->pdir)); // flush stale translations
+  return 0;
+}
+
 int ssleep(int n)
 {
-  uint ticks0; int e = splhi();
+  uint t; int d, e = splhi();
 
-  ticks0 = ticks;
-  while (ticks - ticks0 < n) {
+  t = cyc();
+  for (;;) {
     if (u->killed) {
       splx(e);
       return -1;
     }
-    sleep(&ticks);
+    if ((d = t - cyc()) <= 0) {
+      if (n <= 0) break;
+      d = n < 4096 ? n : 4096; // keep deadlines within reach of a signed compare
+      n -= d;
+      t += d * TICK;
+      continue;
+    }
+    tsleep(&u->timeout, d);
   }
   splx(e);
   return 0;
@@ -1704,14 +1940,29 @@ int socket(int family, int type, int protocol)
   return fd;
 }
 
+// the wait queue a file's input shows up on, 0 if there is nothing to wait for
+struct pollent **pollq(struct file *f)
+{
+  switch (f->type) {
+  case FD_PIPE: return &f->pipe->pollq;
+  case FD_SOCKET: return &sockq[f->off % NSOCKQ];
+  case FD_INODE: if ((f->ip->mode & S_IFMT) == S_IFCHR && f->ip->dir[0] == CONSOLE) return &input.pollq;
+  }
+  return 0;
+}
+
 int poll(struct pollfd *pfd, uint n, int msec)
 {
-  int r, ev; struct file *f; struct pollfd *p, *pn;
-  if (n && !mvalid(pfd, n * sizeof(struct pollfd))) return -1;
+  int r, ev, e, i, nq; uint t, left; struct file *f; struct pollfd *p, *pn;
+  struct pollent pe[NOFILE], **q[NOFILE], **pp, **fq;
+  if (n && !mvalid(pfd, n * sizeof(struct pollfd), 1)) return -1;
   pn = &pfd[n];
+  t = cyc();
+  left = msec;
+  e = splhi();
   for (;;)
   {
-    r = 0;
+    r = nq = 0;
     for (p = pfd; p != pn; p++)
     {
       if (p->fd < 0) continue;
@@ -1720,29 +1971,35 @@ int poll(struct pollfd *pfd, uint n, int msec)
       else if (p->events & POLLIN) {
         switch (f->type) {
         case FD_PIPE: if (f->pipe->nwrite != f->pipe->nread || !f->pipe->writeopen) ev = POLLIN; break;
-        case FD_SOCKET: if (sockpoll(f->off)) ev = POLLIN; break;
+        case FD_SOCKET: if (sockarm(f->off)) ev = POLLIN; break;
         case FD_INODE:
-          if ((f->ip->mode & S_IFMT) == S_IFCHR && f->ip->dir[0] == CONSOLE) {
-            ilock(f->ip);
-            if (input.r != input.w) ev = POLLIN;
-            iunlock(f->ip);
-          }
+          if ((f->ip->mode & S_IFMT) == S_IFCHR && f->ip->dir[0] == CONSOLE && input.r != input.w) ev = POLLIN;
+        }
+        if (!ev && (fq = pollq(f))) { // get on the queue in case nothing is ready yet
+          for (i = 0; i < nq && q[i] != fq; i++) ;
+          if (i == nq) q[nq++] = fq;
         }
       }
-      if (p->revents = ev) { msec = 0; r++; }
+      if (p->revents = ev) r++;
+    }
+    if (r || !msec) break;
+    if (msec > 0) { // extend the deadline a chunk at a time
+      while ((int)(t - cyc()) <= 0 && left) { ev = left < 5000 ? left : 5000; left -= ev; t += ev * MSEC; }
+      if ((int)(t - cyc()) <= 0) break;
     }
-    if (!msec) break;
-    ssleep(1);
-    if (msec > 100) msec -= 100; // XXX this wrongly assumes one tick equals 100ms
-    else if (msec > 0) msec = 0;
+    for (i = 0; i < nq; i++) { pe[i].chan = pe; pe[i].next = *q[i]; *q[i] = &pe[i]; }
+    if (msec > 0) tsleep(pe, t - cyc()); else sleep(pe);
+    for (i = 0; i < nq; i++) { for (pp = q[i]; *pp != &pe[i]; pp = &(*pp)->next) ; *pp = pe[i].next; }
+    if (u->killed) { splx(e); return -1; }
   }
+  splx(e);
   return r;
 }
 // XXX int connect(struct file *s, struct sockaddr *name, uint namelen)
 int connect(int fd, uint *addr, int addrlen)
 {
   struct file *f;
-  if (!(f = getf(fd)) || addrlen < 8 || !mvalid(addr, addrlen)) return -1;
+  if (!(f = getf(fd)) || addrlen < 8 || !mvalid(addr, addrlen, 0)) return -1;
   return sockconnect(f->off, addr[0], addr[1]);
 }
 
@@ -1750,7 +2007,7 @@ int sockbind(int fd, uint family_port, uint addr) { asm(LL,8); asm(LBL,16); asm(
 int bind(int fd, uint *addr, int addrlen)
 {
   struct file *f;
-  if (!(f = getf(fd)) || addrlen < 8 || !mvalid(addr, addrlen)) return -1;
+  if (!(f = getf(fd)) || addrlen < 8 || !mvalid(addr, addrlen, 0)) return -1;
   return sockbind(f->off, addr[0], addr[1]);
 }
 int socklisten() { asm(LL,8); asm(LBL,16); asm(NET8); }
@@ -1767,7 +2024,7 @@ int accept(int fd, uint *addr, int *addrlen) // XXXX params!!!! accept(int,*|0,*
   struct file *f;
   if (!(f = getf(fd))) return -1;
 
-  while (!sockpoll(f->off)) ssleep(1); // XXX
+  if (sockwait(f->off)) return -1;
 
   if ((sd = sockaccept(f->off, 0, 0)) < 0) return sd; // XXX null params for now
 
@@ -1794,6 +2051,51 @@ sleep(void *chan)
   u->chan = 0;
 }
 
+// sleep on channel for at most n cycles, return non-zero if timed out
+int tsleep(void *chan, uint n)
+{
+  struct proc **pp;
+  u->timeout = cyc() + n;
+  for (pp = &timerq; *pp && (int)((*pp)->timeout - u->timeout) <= 0; pp = &(*pp)->tnext) ;
+  u->tnext = *pp;
+  *pp = u;
+  sleep(chan);
+  for (pp = &timerq; *pp; pp = &(*pp)->tnext) {
+    if (*pp == u) { *pp = u->tnext; return 0; } // woken before the deadline
+  }
+  return 1;
+}
+
+// advance ticks to the current cycle count
+uint clock()
+{
+  uint c = cyc(), n;
+  if (n = (c - tickcyc) / TICK) {
+    ticks += n;
+    tickcyc += n * TICK;
+  }
+  return c;
+}
+
+// wake processes whose deadline has passed
+timerintr()
+{
+  uint now = clock(); struct proc *p;
+  while ((p = timerq) && (int)(p->timeout - now) <= 0) {
+    timerq = p->tnext;
+    if (p->state == SLEEPING) p->state = RUNNABLE;
+  }
+}
+
+// program the one-shot timer for the next deadline or the end of the time slice (idle waits for a deadline)
+tmrset()
+{
+  uint now = clock(); int t;
+  t = (u == &proc[0]) ? 1<<30 : TICK; // idle still checks in occasionally so the cycle count cannot wrap unseen
+  if (timerq && (int)(timerq->timeout - now) < t) t = (int)(timerq->timeout - now);
+  stmr(t > 0 ? t : 1);
+}
+
 // wake up all processes sleeping on chan
 wakeup(void *chan)
 {
@@ -1802,6 +2104,12 @@ wakeup(void *chan)
     if (p->state == SLEEPING && p->chan == chan) p->state = RUNNABLE;
 }
 
+// wake up all pollers on wait queue q
+pollwake(struct pollent *q)
+{
+  for (; q; q = q->next) wakeup(q->chan);
+}
+
 // a forked child's very first scheduling will swtch here
 forkret()
 {
@@ -2043,6 +2351,7 @@ sched() // XXX redesign this better
 
 found:
   u->state = RUNNING;
+  tmrset();
   if (p != u) {
     pdir(V2P+(uint)(u->pdir));
     //printf("+");
@@ -2080,7 +2389,7 @@ trap(uint *sp, double g, double f, int c, int b, int a, int fc, uint *pc)
     case S_getpid:  a = u->pid; break;
     case S_sbrk:    a = sbrk(a); break;
     case S_sleep:   a = ssleep(a); break;
-    case S_uptime:  a = ticks; break;
+    case S_uptime:  clock(); a = ticks; break;
     case S_lseek:   a = lseek(a, b, c); break;
 //  case S_mount:   a = mount(a, b, c); break;
 //  case S_umount:  a = umount(a); break;
@@ -2090,7 +2399,10 @@ trap(uint *sp, double g, double f, int c, int b, int a, int fc, uint *pc)
     case S_poll:    a = poll(a, b, c); break;
     case S_accept:  a = accept(a, b, c); break;
     case S_connect: a = connect(a, b, c); break;
-    default: printf("pid:%d name:%s unknown syscall %d\n", u->pid, u->name, a); a = -1; break;
+    case S_sendfile: a = sendfile(a, b, c); break;
+    case S_mmap:    a = mmap(a); break;
+    case S_munmap:  a = munmap(a, b); break;
+    default: if ((pc[-1] >> 8) < S_host) printf("pid:%d name:%s unknown syscall %d\n", u->pid, u->name, a); a = -1; break; // no host intrinsics here
     }
     if (u->killed) exit(-1);
     return;
@@ -2109,15 +2421,14 @@ trap(uint *sp, double g, double f, int c, int b, int a, int fc, uint *pc)
   case FWPAGE + USER:
   case FRPAGE:        // XXX
   case FRPAGE + USER: // XXX
-    if ((va = lvadr()) >= u->sz) exit(-1);
+    if ((va = lvadr()) >= u->sz) { if (!vmfault(va)) exit(-1); } // XXX psignal(SIGSEGV)
+    else mappage(u->pdir, va & -PAGE, V2P+(memset(kalloc(), 0, PAGE)), PTE_P | PTE_W | PTE_U);
     pc--; // printf("fault"); // restart instruction
-    mappage(u->pdir, va & -PAGE, V2P+(memset(kalloc(), 0, PAGE)), PTE_P | PTE_W | PTE_U);
     return;
 
   case FTIMER:
   case FTIMER + USER:
-    ticks++;
-    wakeup(&ticks);
+    timerintr();
 
     // force process exit if it has been killed and is in user space
     if (u->killed && (fc & USER)) exit(-1);
@@ -2130,9 +2441,16 @@ trap(uint *sp, double g, double f, int c, int b, int a, int fc, uint *pc)
     if (u->killed && (fc & USER)) exit(-1);
     return;
 
+  case FNET:
+  case FNET + USER:
+    while ((va = sockready()) != -1) { wakeup(&sockq[va % NSOCKQ]); pollwake(sockq[va % NSOCKQ]); }
+    if (u == &proc[0]) { u->state = RUNNABLE; sched(); }
+    return;
+
   case FKEYBD:
   case FKEYBD + USER:
     consoleintr();
+    if (u == &proc[0]) { u->state = RUNNABLE; sched(); } // leave the idle loop now rather than at the next deadline
     return; //??XXX postkill?
   }
 }
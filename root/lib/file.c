@@ -0,0 +1,5 @@
+// file.c -- file.h as an object for ld:  c -c -o /lib/file.o /lib/file.c
+
+#include <u.h>
+#include <libc.h>
+#include <file.h>
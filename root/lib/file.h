@@ -0,0 +1,252 @@
+// file.h -- buffered streams: fopen, fread, fgets, fprintf and the rest of stdio
+//
+// Include after libc.h.  A stream reads and writes through a buffer of F_BUFSZ bytes, taken with sbrk on first
+// use and kept by its slot.  stdin, stdout and stderr are set up by the first call on them: stdout is line
+// buffered on a terminal (a character device) and fully buffered otherwise, stderr is unbuffered, and reading
+// stdin flushes a line buffered stdout first.  What is still buffered is flushed by exit() and the return from
+// main, and before printf writes to fd 1.  getc and putc only call out to fill or empty the buffer, and are
+// expanded in place from -O22 and -O40.
+
+enum { F_BUFSZ = 4096, FOPEN_MAX = 16 };
+enum { _IOFBF, _IOLBF, _IONBF };
+enum { F_READ = 1, F_WRITE = 2, F_EOF = 4, F_ERR = 8 }; // stream flags, a slot is free while 0
+
+typedef struct {
+  int fd, flags, mode;
+  char *buf, *rp, *re, *wp, *we; // input unread from rp to re, output from buf to wp with room to we
+} FILE;
+
+FILE stdin[1], stdout[1], stderr[1], xfile[FOPEN_MAX];
+
+int fflush(FILE *f) // f 0 flushes every stream
+{
+  int n, r; char *p;
+
+  if (!f) {
+    r = fflush(stdout) | fflush(stderr);
+    for (f = xfile; f < xfile + FOPEN_MAX; f++) r |= fflush(f);
+    return r;
+  }
+  for (p = f->buf; p < f->wp; p += n) {
+    if ((n = write(f->fd, p, f->wp - p)) <= 0) { f->flags |= F_ERR; f->wp = f->buf; return EOF; }
+  }
+  f->wp = f->buf;
+  return 0;
+}
+
+void fflushall(void) { fflush(0); }
+
+int fsetup(FILE *f) // first use of stdin, stdout or stderr
+{
+  struct stat st;
+
+  if (f == stdin) { f->fd = 0; f->flags = F_READ; }
+  else if (f == stdout) { f->fd = 1; f->flags = F_WRITE; f->mode = (fstat(1, &st) || (st.st_mode & S_IFMT) != S_IFCHR) ? _IOFBF : _IOLBF; }
+  else if (f == stderr) { f->fd = 2; f->flags = F_WRITE; f->mode = _IONBF; }
+  else return -1; // closed
+  return 0;
+}
+
+int fbuf(FILE *f)
+{
+  if ((int)(f->buf = sbrk(F_BUFSZ)) == -1) { f->buf = 0; f->flags |= F_ERR; return -1; }
+  f->rp = f->re = f->wp = f->we = f->buf;
+  return 0;
+}
+
+int frd(FILE *f) // ready f for reading
+{
+  if (!f->flags && fsetup(f)) return -1;
+  if (!(f->flags & F_READ)) { f->flags |= F_ERR; return -1; }
+  if (f->wp > f->buf && fflush(f)) return -1;
+  f->we = f->wp; // so the next putc switches back
+  if (f == stdin && stdout[0].mode == _IOLBF) fflush(stdout);
+  return 0;
+}
+
+int fwr(FILE *f) // ready f for writing
+{
+  if (!f->flags && fsetup(f)) return -1;
+  if (!(f->flags & F_WRITE)) { f->flags |= F_ERR; return -1; }
+  if (f->rp < f->re) lseek(f->fd, f->rp - f->re, SEEK_CUR); // give back what was read ahead
+  f->rp = f->re = f->buf;
+  if (f->mode != _IONBF) {
+    if (!f->buf && fbuf(f)) return -1;
+    f->we = f->buf + F_BUFSZ;
+  }
+  xflush = fflushall;
+  return 0;
+}
+
+int fillc(FILE *f) // getc with nothing left in the buffer
+{
+  int n;
+
+  if (frd(f) || (!f->buf && fbuf(f))) return EOF;
+  if ((n = read(f->fd, f->buf, (f->mode == _IONBF) ? 1 : F_BUFSZ)) <= 0) {
+    f->flags |= n ? F_ERR : F_EOF;
+    f->rp = f->re = f->buf;
+    return EOF;
+  }
+  f->rp = f->buf; f->re = f->buf + n;
+  return *(uchar *)f->rp++;
+}
+
+int flushc(int c, FILE *f) // putc with no room, a newline when line buffered, or no buffer
+{
+  char ch;
+
+  if (fwr(f)) return EOF;
+  if (f->mode == _IONBF) {
+    ch = c;
+    if (write(f->fd, &ch, 1) != 1) { f->flags |= F_ERR; return EOF; }
+    return (uchar)c;
+  }
+  if (f->wp >= f->we && fflush(f)) return EOF;
+  *f->wp++ = c;
+  if (c == '\n' && f->mode == _IOLBF && fflush(f)) return EOF;
+  return (uchar)c;
+}
+
+int getc(FILE *f) { return (f->rp >= f->re) ? fillc(f) : *(uchar *)f->rp++; }
+int putc(int c, FILE *f) { return (f->wp >= f->we || (c == '\n' && f->mode == _IOLBF)) ? flushc(c, f) : (uchar)(*f->wp++ = c); }
+int fgetc(FILE *f) { return getc(f); }
+int fputc(int c, FILE *f) { return putc(c, f); }
+int getchar(void) { return getc(stdin); }
+int putchar(int c) { return putc(c, stdout); }
+
+int ungetc(int c, FILE *f)
+{
+  if (c == EOF || (!f->flags && fsetup(f)) || (!f->buf && fbuf(f))) return EOF;
+  if (f->rp == f->re) f->rp = f->re = f->buf + F_BUFSZ;
+  else if (f->rp == f->buf) return EOF;
+  *--f->rp = c;
+  f->flags &= ~F_EOF;
+  return (uchar)c;
+}
+
+FILE *fdopen(int fd, char *mode)
+{
+  FILE *f;
+
+  for (f = xfile; f < xfile + FOPEN_MAX && f->flags; f++) ;
+  if (f == xfile + FOPEN_MAX) return 0;
+  f->fd = fd;
+  f->flags = strchr(mode, '+') ? F_READ | F_WRITE : (*mode == 'r') ? F_READ : F_WRITE;
+  f->mode = _IOFBF;
+  f->rp = f->re = f->wp = f->we = f->buf;
+  return f;
+}
+
+FILE *fopen(char *name, char *mode)
+{
+  int fd, m; FILE *f;
+
+  switch (*mode) {
+  case 'r': m = O_RDONLY; break;
+  case 'w': m = O_WRONLY | O_CREAT | O_TRUNC; break;
+  case 'a': m = O_WRONLY | O_CREAT; break;
+  default: return 0;
+  }
+  if (strchr(mode, '+')) m = (m & ~3) | O_RDWR;
+  if ((fd = open(name, m)) < 0) return 0;
+  if (!(f = fdopen(fd, mode))) { close(fd); return 0; }
+  if (*mode == 'a') lseek(fd, 0, SEEK_END);
+  return f;
+}
+
+int fclose(FILE *f)
+{
+  int r;
+
+  if (!f->flags && fsetup(f)) return EOF;
+  r = fflush(f);
+  if (close(f->fd) < 0) r = EOF;
+  f->flags = 0;
+  f->rp = f->re = f->wp = f->we = f->buf;
+  return r;
+}
+
+int setvbuf(FILE *f, char *buf, int mode, int size) // the slot's own buffer is always used
+{
+  if ((!f->flags && fsetup(f)) || mode < _IOFBF || mode > _IONBF) return -1;
+  if (f->wp > f->buf && fflush(f)) return -1;
+  f->mode = mode;
+  f->we = f->wp;
+  return 0;
+}
+
+int feof(FILE *f) { return f->flags & F_EOF; }
+int ferror(FILE *f) { return f->flags & F_ERR; }
+void clearerr(FILE *f) { f->flags &= ~(F_EOF | F_ERR); }
+int fileno(FILE *f) { if (!f->flags) fsetup(f); return f->fd; }
+
+int fread(void *v, int size, int n, FILE *f)
+{
+  char *p = v; int k, m, t = size * n;
+
+  for (k = 0; k < t; k += m) {
+    if ((m = f->re - f->rp) > 0) { // what is buffered
+      if (m > t - k) m = t - k;
+      memcpy(p + k, f->rp, m);
+      f->rp += m;
+    } else if (t - k >= F_BUFSZ) { // a buffer or more straight in
+      if (frd(f)) break;
+      if ((m = read(f->fd, p + k, t - k)) <= 0) { f->flags |= m ? F_ERR : F_EOF; break; }
+    } else {
+      if ((m = fillc(f)) == EOF) break;
+      p[k] = m; m = 1;
+    }
+  }
+  return size ? k / size : 0;
+}
+
+int fwrite(void *v, int size, int n, FILE *f)
+{
+  char *p = v; int k, m, t = size * n;
+
+  if (t <= 0) return 0;
+  if (t < f->we - f->wp && (f->mode != _IOLBF || !memchr(p, '\n', t))) { memcpy(f->wp, p, t); f->wp += t; return n; }
+  if (fwr(f)) return 0;
+  if (f->mode == _IONBF || t >= F_BUFSZ) { // straight out
+    if (fflush(f)) return 0;
+    for (k = 0; k < t; k += m) {
+      if ((m = write(f->fd, p + k, t - k)) <= 0) { f->flags |= F_ERR; return k / size; }
+    }
+    return n;
+  }
+  if (t > f->we - f->wp && fflush(f)) return 0;
+  memcpy(f->wp, p, t);
+  f->wp += t;
+  if (f->mode == _IOLBF && memchr(p, '\n', t) && fflush(f)) return 0;
+  return n;
+}
+
+char *fgets(char *s, int n, FILE *f) // a line of up to n-1 chars, newline kept
+{
+  char *p = s, *q; int m;
+
+  if (n < 1) return 0;
+  while (n > 1) {
+    if ((m = f->re - f->rp) <= 0) {
+      if ((m = fillc(f)) == EOF) break;
+      *p++ = m; n--;
+      if (m == '\n') break;
+      continue;
+    }
+    if (m > n - 1) m = n - 1;
+    if (q = memchr(f->rp, '\n', m)) m = q + 1 - f->rp;
+    memcpy(p, f->rp, m);
+    p += m; f->rp += m; n -= m;
+    if (q) break;
+  }
+  if (p == s && n > 1) return 0;
+  *p = 0;
+  return s;
+}
+
+int fputs(char *s, FILE *f) { int n = strlen(s); return (fwrite(s, 1, n, f) == n) ? n : EOF; }
+int puts(char *s) { return (fputs(s, stdout) == EOF || putc('\n', stdout) == EOF) ? EOF : 0; }
+
+int vfprintf(FILE *f, char *fmt, va_list v) { char s[BUFSIZ]; int n = vsprintf(s, fmt, v); return (fwrite(s, 1, n, f) == n) ? n : EOF; }
+int fprintf(FILE *f, char *fmt, ...) { va_list v; va_start(v, fmt); return vfprintf(f, fmt, v); }
@@ -0,0 +1,9 @@
+// forms.c -- forms.h as an object for ld:  c -c -o /lib/forms.o /lib/forms.c
+
+#include <u.h>
+#include <libc.h>
+#include <libm.h>
+#include <net.h>
+#include <gl.h>
+#include <font.h>
+#include <forms.h>
@@ -0,0 +1,4 @@
+// libc.c -- libc.h as an object for ld:  c -c -o /lib/libc.o /lib/libc.c
+
+#include <u.h>
+#include <libc.h>
@@ -6,8 +6,9 @@ enum { O_RDONLY, O_WRONLY, O_RDWR, O_CREAT = 0x100, O_TRUNC = 0x200 };
 enum { SEEK_SET, SEEK_CUR, SEEK_END };
 enum { BUFSIZ = 1024, NAME_MAX = 256, PATH_MAX = 256 }; // XXX
 enum { POLLIN = 1, POLLOUT = 2, POLLNVAL = 4 };
+enum { PROT_READ = 1, PROT_WRITE = 2, MAP_SHARED = 1, MAP_PRIVATE = 2, MAP_ANON = 0x20 };
 
-struct stat { ushort st_dev; ushort st_mode; uint st_ino; uint st_nlink; uint st_size; };
+struct stat { ushort st_dev; ushort st_mode; uint st_ino; uint st_nlink; uint st_size; uint st_gen; };
 struct pollfd { int fd; short events, revents; };
 
 // intrinsics
@@ -18,7 +19,7 @@ void *memchr() { asm(LL,8); asm(LBLB,16); asm(LCL,24); asm(MCHR); }
 
 // system calls
 fork()   { asm(TRAP,S_fork); }
-exit()   { asm(LL,8); asm(TRAP,S_exit); }
+_exit()  { asm(LL,8); asm(TRAP,S_exit); }
 wait()   { asm(TRAP,S_wait); }
 pipe()   { asm(LL,8); asm(TRAP,S_pipe); }
 write()  { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_write); }
@@ -42,14 +43,33 @@ lseek()  { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_lseek); }
 mount()  { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_mount); }
 umount() { asm(LL,8); asm(TRAP,S_umount); }
 poll()   { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_poll); }
+sendfile() { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_sendfile); } // sendfile(out, in, n) from the file offset of in
+void *mmap() { asm(LEA,8); asm(TRAP,S_mmap); } // mmap(addr, len, prot, flags, fd, off) passes its argument block, returns -1 on error
+munmap() { asm(LL,8); asm(LBL,16); asm(TRAP,S_munmap); }
+
+// exit flushes what file.h is holding.  xstart is the entry of programs that include libc.h
+void (*xflush)();
+exit(int rc) { if (xflush) xflush(); _exit(rc); }
+int main();
+xstart(int argc, char **argv) { exit(main(argc, argv)); }
+
+// host intrinsics, tried once and then only when eu is running us
+int xhost = -1;
+hostq()      { asm(TRAP,S_host); }
+hvsprintf()  { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_vsprintf); }
+hstrcmp()    { asm(LL,8); asm(LBL,16); asm(TRAP,S_strcmp); }
+hstrncmp()   { asm(LL,8); asm(LBL,16); asm(LCL,24); asm(TRAP,S_strncmp); }
+char *hstrstr() { asm(LL,8); asm(LBL,16); asm(TRAP,S_strstr); }
+int host() { if (xhost < 0) xhost = !hostq(); return xhost; }
 
 // string routines
-int strcmp(char *d, char *s) { for (; *d == *s; d++, s++) if (!*d) return 0; return *d - *s; }
+int strcmp(char *d, char *s) { if (xhost && host()) return hstrcmp(d, s); for (; *d == *s; d++, s++) if (!*d) return 0; return *d - *s; }
 int strlen(char *s) { return memchr(s, 0, -1) - s; }
 char *strcpy(char *d, char *s) { return memcpy(d, s, strlen(s)+1); }
 char *strcat(char *d, char *s) { memcpy(memchr(d, 0, -1), s, strlen(s)+1); return d; }
-int strncmp(char *d, char *s, int n) { while (n > 0) { if (!*d || *d != *s) return *d - *s; n--; d++; s++; } return 0; }
+int strncmp(char *d, char *s, int n) { if (xhost && host()) return hstrncmp(d, s, n); while (n > 0) { if (!*d || *d != *s) return *d - *s; n--; d++; s++; } return 0; }
 char *strchr(char *s, int c) { return memchr(s, c, strlen(s)); }
+char *strstr(char *s, char *t) { int n; if (xhost && host()) return hstrstr(s, t); for (n = strlen(t); strncmp(s, t, n); s++) if (!*s) return 0; return s; }
 // XXX strncpy
 // XXX index
 // XXX rindex
@@ -68,6 +88,7 @@ int vsprintf(char *s, char *f, va_list v)
   int i, left, fmax, fmin, sign, prec;
   double d;
 
+  if (xhost && host()) return hvsprintf(s, f, v);
   while (c = *f++) {
     if (c != '%') { *e++ = c; continue; }
     if (*f == '%') { *e++ = *f++; continue; }
@@ -108,14 +129,11 @@ int vsprintf(char *s, char *f, va_list v)
 }
 
 int sprintf(char *s, char *f, ...) { va_list v; va_start(v, f); return vsprintf(s, f, v); }
-int printf(char *f, ...) { char s[BUFSIZ]; va_list v; va_start(v, f); return write(1, s, vsprintf(s, f, v)); }
-int vprintf(char *f, va_list v) { char s[BUFSIZ]; return write(1, s, vsprintf(s, f, v)); }
+int printf(char *f, ...) { char s[BUFSIZ]; va_list v; if (xflush) xflush(); va_start(v, f); return write(1, s, vsprintf(s, f, v)); }
+int vprintf(char *f, va_list v) { char s[BUFSIZ]; if (xflush) xflush(); return write(1, s, vsprintf(s, f, v)); }
 int dprintf(int d, char *f, ...) { char s[BUFSIZ]; va_list v; va_start(v, f); return write(d, s, vsprintf(s, f, v)); }
 int vdprintf(int d, char *f, va_list v) { char s[BUFSIZ]; return write(d, s, vsprintf(s, f, v)); }
 
-void *malloc(uint n) { int i = sbrk(n); return (i == -1) ? 0 : i; } // XXX placeholder, see mem.h
-void free(void *p) { } // XXX
-
 int atoi(char *s)
 {
   int i = 0, n; char c;
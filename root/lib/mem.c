@@ -0,0 +1,5 @@
+// mem.c -- mem.h as an object for ld:  c -c -o /lib/mem.o /lib/mem.c
+
+#include <u.h>
+#include <libc.h>
+#include <mem.h>
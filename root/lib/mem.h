@@ -1,69 +1,215 @@
-// mem.h -- modifed K&R memory allocator  XXX do not use... currently under development
+// mem.h -- memory allocator: malloc, free, realloc, calloc and memalign
+//
+// Include after libc.h.  Each chunk has an 8 byte header holding the size of the chunk before it and its own
+// size, with M_USED set while it is in use and M_MAPPED if it was mapped on its own.  Small chunks are cached
+// on a free list per size when freed and handed straight back out, and only merged into the heap when a large
+// request would otherwise grow it or a free leaves M_GROW or more free in one piece.  Larger free chunks are merged with free neighbors and kept in bins by power
+// of two.  The heap grows at its top with sbrk and gives the top back past M_TRIM free.  Requests of M_MAPMIN
+// and up are mapped on their own (with mmap, falling back to the heap if that fails.)
 
-struct alloc_s { struct alloc_s *ptr; uint size; } *allocp;
+enum {
+  M_USED = 1, M_MAPPED = 2, // chunk size flags
+  M_MIN = 16,               // smallest chunk: the header and two free list links
+  M_SMALL = 264,            // largest chunk kept on the per size free lists
+  M_GROW = 64*1024,         // heap growth step
+  M_TRIM = 256*1024,        // top free space given back past this
+  M_MAPMIN = 256*1024,      // requests mapped on their own
+};
 
-void free(void *ptr)
+struct mchunk { uint psize, size; struct mchunk *next, *prev; };
+
+struct mchunk *mfast[M_SMALL/8 + 1], *mbin[32], *mtop; // per size lists, bins, and the free space at the top
+uint mbits;   // bins in use
+int mcached;  // chunks sitting on the per size lists
+
+int mbinof(uint sz) { int b; for (b = 4; sz >> (b + 1); b++) ; return b; }
+
+void mlink(struct mchunk *p) // put free chunk p in its bin
 {
-  struct alloc_s *p, *q;
-
-  p = (struct alloc_s *)ptr - 1;
-  for (q = allocp; p <= q || p >= q->ptr; q = q->ptr)
-    if (q >= q->ptr && (p > q || p < q->ptr))
-      break;
-  if (p + p->size == q->ptr) {
-    p->size += q->ptr->size;
-    p->ptr = q->ptr->ptr;
-  } else
-    p->ptr = q->ptr;
-  if (q + q->size == p) {
-    q->size += p->size;
-    q->ptr = p->ptr;
-  } else
-    q->ptr = p;
-  allocp = q;
+  int b = mbinof(p->size);
+  if (p->next = mbin[b]) mbin[b]->prev = p;
+  p->prev = 0;
+  mbin[b] = p;
+  mbits |= 1 << b;
 }
 
-void *malloc(uint n)
+void mdrop(struct mchunk *p) // take free chunk p out of its bin
+{
+  int b;
+  if (p->next) p->next->prev = p->prev;
+  if (p->prev) p->prev->next = p->next;
+  else if (!(mbin[b = mbinof(p->size)] = p->next)) mbits &= ~(1 << b);
+}
+
+void mtrim(void) // give back the top past M_TRIM free, if the heap still ends there
+{
+  uint n;
+  if (mtop->size <= M_TRIM || (char *)mtop + mtop->size != sbrk(0)) return;
+  n = (mtop->size - M_GROW) & -M_GROW;
+  if ((int)sbrk(-n) != -1) mtop->size -= n;
+}
+
+// make the top hold a chunk of sz and still be a chunk itself
+int mgrow(uint sz)
 {
-  static struct alloc_s base;
-  struct alloc_s *p, *q;
-  uint nu;
-
-  n = 1 + (n + sizeof(struct alloc_s) - 1) / sizeof(struct alloc_s);
-  if (!(q = allocp)) {
-    base.ptr = allocp = q = &base; // XXX do this with sbrk vs base?
-    base.size = 0;
+  uint n, t; char *p; struct mchunk *q;
+
+  if (mtop && (char *)mtop + mtop->size == sbrk(0)) { // the heap still ends at the top
+    n = (sz + M_MIN - mtop->size + M_GROW - 1) & -M_GROW;
+    if ((int)sbrk(n) == -1) return -1;
+    mtop->size += n;
+    return 0;
   }
-  for (p = q->ptr; ; q = p, p = p->ptr) {
-    if (p->size >= n) {
-      if (p->size == n)
-        q->ptr = p->ptr;
-      else {
-        p->size -= n;
-        p += p->size;
-        p->size = n;
-      }
-      allocp = q;
-      return (void *)(p + 1);
-    }
-    if (p == allocp) {
-      nu = n < 4096 ? 4096 : n;
-      p = (struct alloc_s *) sbrk(nu * sizeof(struct alloc_s));
-      if ((int)p == -1) return 0;
-      p->size = nu;
-      free((void *)(p + 1));
-      p = allocp;
+  n = (sz + M_MIN + 8 + M_GROW - 1) & -M_GROW;
+  if ((int)(p = sbrk(n)) == -1) return -1;
+  if (mtop) { // someone else moved the break: the old top becomes a free chunk, walled off by an in use one
+    t = mtop->size - 8;
+    q = (struct mchunk *)((char *)mtop + t); q->psize = t; q->size = 8 | M_USED;
+    if (t < M_MIN) mtop->size = t | M_USED; else { mtop->size = t; mlink(mtop); }
+  }
+  t = -(uint)p & 7;
+  mtop = (struct mchunk *)(p + t); mtop->psize = 0; mtop->size = n - t;
+  return 0;
+}
+
+// give free chunk p of size sz back to the heap, merging it with free neighbors.  returns the merged size
+uint mrelease(struct mchunk *p, uint sz)
+{
+  struct mchunk *q;
+
+  if (p->psize && !((q = (struct mchunk *)((char *)p - p->psize))->size & M_USED)) { mdrop(q); sz += q->size; p = q; }
+  q = (struct mchunk *)((char *)p + sz);
+  if (q == mtop) { p->size = sz + q->size; mtop = p; mtrim(); return p->size; }
+  if (!(q->size & M_USED)) { mdrop(q); sz += q->size; q = (struct mchunk *)((char *)p + sz); }
+  p->size = sz; q->psize = sz;
+  mlink(p);
+  return sz;
+}
+
+void mflush(void) // merge the chunks cached on the per size lists back into the heap
+{
+  int i; struct mchunk *p, *q;
+  for (i = M_MIN/8; i <= M_SMALL/8; i++) {
+    for (p = mfast[i]; p; p = q) { q = p->next; mrelease(p, p->size & -8); }
+    mfast[i] = 0;
+  }
+  mcached = 0;
+}
+
+void *mtake(struct mchunk *p, uint sz) // in use chunk p cut down to sz, the rest going back to the heap
+{
+  struct mchunk *q; uint s = p->size & -8;
+  if (s - sz >= M_MIN) {
+    p->size = sz | M_USED;
+    q = (struct mchunk *)((char *)p + sz); q->psize = sz;
+    mrelease(q, s - sz);
+  }
+  return &p->next;
+}
+
+uint msize(uint n) { return (n + 15 < M_MIN) ? M_MIN : (n + 15) & -8; } // chunk size for n bytes
+
+void *malloc(uint n)
+{
+  uint sz, m; int b; struct mchunk *p;
+
+  if (n > 0x7fff0000) return 0;
+  sz = msize(n);
+  if (sz <= M_SMALL && (p = mfast[sz/8])) { mfast[sz/8] = p->next; mcached--; return &p->next; }
+
+  if (sz >= M_MAPMIN) {
+    m = (sz + 4095) & -4096;
+    if ((int)(p = mmap(0, m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0)) != -1) {
+      p->psize = 0; p->size = m | M_USED | M_MAPPED;
+      return &p->next;
     }
   }
+
+  for (;;) {
+    b = mbinof(sz);
+    for (p = mbin[b]; p && p->size < sz; p = p->next) ;
+    if (!p && (m = mbits >> b >> 1)) { for (b++; !(m & 1); m >>= 1) b++; p = mbin[b]; } // any chunk in a later bin fits
+    if (p) { mdrop(p); p->size |= M_USED; return mtake(p, sz); }
+    if (sz <= M_SMALL || !mcached) break;
+    mflush();
+  }
+
+  if ((!mtop || mtop->size < sz + M_MIN) && mgrow(sz)) return 0;
+  p = mtop;
+  mtop = (struct mchunk *)((char *)p + sz); mtop->psize = sz; mtop->size = p->size - sz;
+  p->size = sz | M_USED;
+  return &p->next;
 }
 
-void *memalign(uint bound, uint n)
+void free(void *v)
 {
+  struct mchunk *p; uint sz;
 
+  if (!v) return;
+  p = (struct mchunk *)((char *)v - 8);
+  sz = p->size & -8;
+  if (p->size & M_MAPPED) { munmap((char *)p - p->psize, p->psize + sz); return; }
+  if (sz <= M_SMALL) { p->next = mfast[sz/8]; mfast[sz/8] = p; mcached++; return; }
+  if (mrelease(p, sz) >= M_GROW && mcached) mflush(); // a big free space, so the cached chunks may be hemming it in
 }
 
-void *realloc(void *ptr, uint n)
+void *realloc(void *v, uint n)
 {
+  struct mchunk *p, *q; uint s, sz; void *w;
 
+  if (!v) return malloc(n);
+  if (!n) { free(v); return 0; }
+  if (n > 0x7fff0000) return 0;
+  sz = msize(n);
+  p = (struct mchunk *)((char *)v - 8);
+  s = p->size & -8;
+  if (p->size & M_MAPPED) { if (sz <= s) return v; }
+  else if (sz <= s) return (s > M_SMALL) ? mtake(p, sz) : v;
+  else if ((q = (struct mchunk *)((char *)p + s)) == mtop) { // grow into the top, growing that if need be
+    if (s + q->size >= sz + M_MIN || (!mgrow(sz - s) && q == mtop)) {
+      mtop = (struct mchunk *)((char *)p + sz); mtop->psize = sz; mtop->size = s + q->size - sz;
+      p->size = sz | M_USED;
+      return v;
+    }
+  }
+  else if (!(q->size & M_USED) && s + q->size >= sz) { // or into a free chunk after it
+    mdrop(q);
+    s += q->size;
+    p->size = s | M_USED;
+    ((struct mchunk *)((char *)p + s))->psize = s;
+    return mtake(p, sz);
+  }
+  if (!(w = malloc(n))) return 0;
+  memcpy(w, v, (s - 8 < n) ? s - 8 : n);
+  free(v);
+  return w;
 }
 
+void *calloc(uint n, uint m)
+{
+  void *p;
+  if (m && n > 0x7fff0000 / m) return 0;
+  if (p = malloc(n * m)) memset(p, 0, n * m);
+  return p;
+}
+
+// n bytes at a multiple of bound, a power of two
+void *memalign(uint bound, uint n)
+{
+  struct mchunk *p, *q; char *v; uint s, lead;
+
+  if (bound <= 8) return malloc(n);
+  if ((bound & (bound - 1)) || n > 0x7fff0000 - bound) return 0;
+  if (!(v = malloc(n + bound + M_MIN))) return 0;
+  p = (struct mchunk *)(v - 8);
+  if (!((uint)v & (bound - 1))) return (p->size & M_MAPPED) ? v : mtake(p, msize(n));
+  s = p->size & -8;
+  lead = (((uint)v + M_MIN + bound - 1) & -bound) - (uint)v; // room for a chunk before the aligned one
+  q = (struct mchunk *)((char *)p + lead);
+  if (p->size & M_MAPPED) { q->psize = p->psize + lead; q->size = (s - lead) | M_USED | M_MAPPED; return &q->next; }
+  q->psize = lead; q->size = (s - lead) | M_USED;
+  ((struct mchunk *)((char *)q + s - lead))->psize = s - lead;
+  p->size = lead | M_USED;
+  free(&p->next);
+  return mtake(q, msize(n));
+}
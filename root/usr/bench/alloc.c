@@ -0,0 +1,63 @@
+// alloc -- memory allocator benchmark
+//
+// Usage:  alloc [-n ops]
+//
+// Description:
+//   Runs ops (default 100000) random operations on a table of 1000 blocks from mem.h and
+//   reports cycles per operation, and the peak heap size beside the peak of bytes held.
+//   The small pass allocates and frees blocks of 8 to 256 bytes.  The mixed pass adds
+//   blocks up to 8K and a few of 64K, and resizes blocks with realloc.
+
+#include <u.h>
+#include <libc.h>
+#include <mem.h>
+
+enum { SLOTS = 1000 };
+
+char *blk[SLOTS];
+uint len[SLOTS], seed = 1, base, peak, held, hpeak;
+
+uint cyc() { asm(CYC); }
+
+uint rnd() { seed = seed * 1103515245 + 12345; return seed >> 8; }
+
+uint size(int mixed)
+{
+  uint r = rnd() % 100;
+  if (!mixed || r < 80) return 8 + rnd() % 249;
+  return (r < 98) ? rnd() % 8192 : 65536;
+}
+
+void run(char *name, int n, int mixed)
+{
+  int i, j, k; uint c, t, s;
+
+  peak = hpeak = held = 0; base = (uint)sbrk(0);
+  for (t = j = 0; j < n; j++) {
+    k = rnd() % SLOTS;
+    s = blk[k] ? 0 : size(mixed);
+    c = cyc();
+    if (!blk[k]) blk[k] = malloc(s);
+    else if (mixed && (rnd() & 1)) blk[k] = realloc(blk[k], s = size(mixed));
+    else { free(blk[k]); blk[k] = 0; }
+    t += cyc() - c;
+    if (blk[k]) { blk[k][0] = k; held += s; } // touch the block
+    held -= len[k]; len[k] = s;
+    if (held > hpeak) hpeak = held;
+    if ((c = (uint)sbrk(0) - base) > peak) peak = c;
+  }
+  for (i = 0; i < SLOTS; i++) { free(blk[i]); blk[i] = 0; len[i] = 0; }
+  printf("%s: %d cycles per op, peak heap %dK for %dK held, %dK left after freeing\n",
+    name, t / n, peak / 1024, hpeak / 1024, ((uint)sbrk(0) - base) / 1024);
+}
+
+int main(int argc, char *argv[])
+{
+  int n = 100000;
+
+  if (argc > 2 && !strcmp(argv[1], "-n")) { n = atoi(argv[2]); argc -= 2; argv += 2; }
+  if (argc > 1 || n < 1) { dprintf(2, "usage: alloc [-n ops]\n"); return -1; }
+  run("small", n, 0);
+  run("mixed", n, 1);
+  return 0;
+}
@@ -0,0 +1,121 @@
+// cc -- compiler throughput benchmark
+//
+// Usage:  cc [-n runs] [-O] [file ...]
+//         cc -g lines file
+//
+// Description:
+//   Runs /bin/c over each file (by default /bin/c.c, /etc/os.c, /usr/demo/calc.c, /bin/vt.c
+//   and a generated 20000 line file, about as much as the RAM file system has room for)
+//   writing a scratch executable, and reports the median cycles per compile and the source
+//   lines compiled per million cycles.  -O is passed on to the compiler.  With -g, writes a
+//   generated source file of about lines lines and exits (bench.sh uses this to time the
+//   host builds of the compiler on a 50000 line file.)  Times assume the nominal 100
+//   emulator cycles per usec.
+
+#include <u.h>
+#include <libc.h>
+
+enum { CYCUS = 100, RUNS = 16, LINES = 20000 }; // nominal cycles per microsecond, max runs, generated size
+
+char buf[64*1024], *bp;
+int out;
+uint t[RUNS];
+
+uint cyc() { asm(CYC); }
+
+void put(char *f, ...) // buffered output for the generator
+{
+  va_list v;
+  if (bp > buf + sizeof(buf) - 1024) { write(out, buf, bp - buf); bp = buf; }
+  va_start(v, f);
+  bp += vsprintf(bp, f, v);
+}
+
+// a mix of declarations, loops, switches, struct and array accesses, calls and floating
+// point, 29 lines per function
+int gen(char *name, int lines)
+{
+  int k, n;
+
+  if ((out = open(name, O_WRONLY | O_CREAT | O_TRUNC)) < 0) { dprintf(2, "cc: can't create %s\n", name); return -1; }
+  bp = buf;
+  put("// generated by cc -g %d\n#include <u.h>\n#include <libc.h>\n\n", lines);
+  n = lines / 29;
+  for (k = 0; k < n; k++) {
+    put("struct s%d { int a, b; char c[8]; struct s%d *next; };\n", k, k);
+    put("int g%d[16];\nchar t%d[] = \"text %d\\n\";\n\n", k, k, k);
+    put("int f%d(int x, int y)\n{\n  int i, s; struct s%d v, *p;\n\n", k, k);
+    put("  s = 0;\n  p = &v;\n  for (i = 0; i < 16; i++) {\n    g%d[i] = x * i + y;\n", k);
+    put("    if (g%d[i] & 1) s += g%d[i] >> 1; // odd\n    else s -= i;\n  }\n", k, k);
+    put("  p->a = s; p->b = x; p->c[x & 7] = *t%d;\n", k);
+    put("  switch (x & 7) {\n  case 0: s++; break;\n  case 1: s += y; break;\n");
+    put("  case 3: s ^= 0x55; break;\n  case 6: s = s * %d; break;\n  default: s--;\n  }\n", k + 3);
+    put("  while (s > 1000) s = s / 3;\n");
+    if (k) put("  return f%d(s, y) + p->a;\n}\n\n", k - 1); else put("  return s + p->a;\n}\n\n");
+    put("double d%d(double a) { return a * %d.5 + 1.0 / (a + 1.0); }\n\n", k, k);
+  }
+  put("int main(int argc, char *argv[])\n{\n  return f%d(argc, 1) + (int)d%d(2.0);\n}\n", n - 1, n - 1);
+  write(out, buf, bp - buf);
+  close(out);
+  return 0;
+}
+
+int lines(char *name)
+{
+  int f, n, i, r;
+  if ((f = open(name, O_RDONLY)) < 0) { dprintf(2, "cc: can't open %s\n", name); exit(-1); }
+  for (n = 0; (r = read(f, buf, sizeof(buf))) > 0; ) for (i = 0; i < r; i++) if (buf[i] == '\n') n++;
+  close(f);
+  return n;
+}
+
+uint run(char *file, int opt)
+{
+  uint c; char *argv[6];
+
+  c = cyc();
+  if (!fork()) {
+    argv[0] = "/bin/c"; argv[1] = "-o"; argv[2] = "/usr/bench/cc.x";
+    argv[3] = opt ? "-O" : file; argv[4] = opt ? file : 0; argv[5] = 0;
+    exec("/bin/c", argv);
+    dprintf(2, "cc: exec(/bin/c) failed\n");
+    exit(-1);
+  }
+  wait();
+  return cyc() - c;
+}
+
+uint median(int n)
+{
+  int i, j; uint x;
+  for (i = 1; i < n; i++) {
+    for (x = t[i], j = i; j > 0 && t[j-1] > x; j--) t[j] = t[j-1];
+    t[j] = x;
+  }
+  return t[n/2];
+}
+
+int main(int argc, char *argv[])
+{
+  int i, n, opt, nl; uint m; char *def[6];
+
+  if (argc == 4 && !strcmp(argv[1], "-g")) return gen(argv[3], atoi(argv[2]));
+  n = 3; opt = 0; def[4] = 0;
+  if (argc > 2 && !strcmp(argv[1], "-n")) { n = atoi(argv[2]); argc -= 2; argv += 2; }
+  if (argc > 1 && !strcmp(argv[1], "-O")) { opt = 1; argc--; argv++; }
+  if (n < 1 || n > RUNS) { dprintf(2, "usage: cc [-n runs] [-O] [file ...]\n"); return -1; }
+  if (argc < 2) {
+    def[0] = "/bin/c.c"; def[1] = "/etc/os.c"; def[2] = "/usr/demo/calc.c"; def[3] = "/bin/vt.c"; def[4] = "/usr/bench/ccgen.c";
+    if (gen(def[4], LINES)) return -1;
+    argv = def - 1; argc = 6;
+  }
+  for (argc--, argv++; argc; argc--, argv++) {
+    nl = lines(*argv);
+    for (i = 0; i < n; i++) t[i] = run(*argv, opt);
+    m = median(n);
+    printf("%s: %d lines, %u cycles median, %.2f ms, %d lines/Mcycle\n", *argv, nl, m, (double)m / (CYCUS * 1000), (int)(nl * 1000000.0 / m));
+  }
+  unlink("/usr/bench/cc.x");
+  if (argv[-1] == def[4]) unlink(def[4]);
+  return 0;
+}
@@ -0,0 +1,72 @@
+// exec -- compile-and-go startup latency benchmark
+//
+// Usage:  exec [-n runs] [command]
+//
+// Description:
+//   Runs command (default /bin/ls) repeatedly with its output drained through a pipe and
+//   reports the median time from fork to exit.  The command is run from its source,
+//   first with the compiled-binary cache cleared before every run (cold) and then with
+//   it left in place (warm).  Times assume the nominal 100 emulator cycles per usec.
+
+#include <u.h>
+#include <libc.h>
+
+enum { CYCUS = 100, RUNS = 64 };    // nominal cycles per microsecond, max runs
+
+char buf[4096];
+uint t[RUNS];
+
+uint cyc() { asm(CYC); }
+
+uint run(char *cmd)
+{
+  int fd[2]; uint c; char *argv[2];
+
+  if (pipe(fd) < 0) { dprintf(2, "exec: pipe() failed\n"); exit(-1); }
+  c = cyc();
+  if (!fork()) {
+    close(fd[0]);
+    dup2(fd[1], 1);
+    close(fd[1]);
+    argv[0] = cmd; argv[1] = 0;
+    exec(cmd, argv);
+    dprintf(2, "exec: exec(%s) failed\n", cmd);
+    exit(-1);
+  }
+  close(fd[1]);
+  while (read(fd[0], buf, sizeof(buf)) > 0);
+  close(fd[0]);
+  wait();
+  return cyc() - c;
+}
+
+uint median(int n)
+{
+  int i, j; uint x;
+  for (i = 1; i < n; i++) {
+    for (x = t[i], j = i; j > 0 && t[j-1] > x; j--) t[j] = t[j-1];
+    t[j] = x;
+  }
+  return t[n/2];
+}
+
+int main(int argc, char *argv[])
+{
+  int i, n; char *cmd, *p, x[PATH_MAX], d[PATH_MAX];
+
+  n = 8;
+  if (argc > 2 && !strcmp(argv[1], "-n")) { n = atoi(argv[2]); argc -= 2; argv += 2; }
+  cmd = argc > 1 ? argv[1] : "/bin/ls";
+  if (n < 1 || n > RUNS) { dprintf(2, "usage: exec [-n runs] [command]\n"); return -1; }
+
+  // cache entries are named after the source path with '/' mapped to '_'
+  p = x + sprintf(x, "/usr/cache/%s.c", cmd);
+  while (--p > x + 10) if (*p == '/') *p = '_';
+  sprintf(d, "%s.d", x); strcat(x, ".x");
+
+  for (i = 0; i < n; i++) { unlink(x); unlink(d); t[i] = run(cmd); }
+  printf("%s cold: %u cycles median, %.2f ms\n", cmd, median(n), (double)t[n/2] / (CYCUS * 1000));
+  for (i = 0; i < n; i++) t[i] = run(cmd);
+  printf("%s warm: %u cycles median, %.2f ms\n", cmd, median(n), (double)t[n/2] / (CYCUS * 1000));
+  return 0;
+}
@@ -0,0 +1,43 @@
+// pipe -- pipe throughput benchmark
+//
+// Usage:  pipe [-s size] [megabytes]
+//
+// Description:
+//   A forked writer pushes the data through a pipe in size byte writes (default 4096)
+//   while the parent reads it back.  Rates assume the nominal 100 emulator cycles per usec.
+
+#include <u.h>
+#include <libc.h>
+
+enum { CYCUS = 100 };    // nominal cycles per microsecond
+
+char buf[64*1024];
+
+uint cyc() { asm(CYC); }
+
+int main(int argc, char *argv[])
+{
+  int fd[2], n, r, bs, mb; uint t, total;
+
+  bs = 4096; mb = 4;
+  if (argc > 2 && !strcmp(argv[1], "-s")) { bs = atoi(argv[2]); argc -= 2; argv += 2; }
+  if (argc > 1) mb = atoi(argv[1]);
+  if (bs < 1 || bs > sizeof(buf) || mb < 1) { dprintf(2, "usage: pipe [-s size] [megabytes]\n"); return -1; }
+
+  memset(buf, 0, sizeof(buf)); // fault the buffer in up front
+  if (pipe(fd) < 0) { dprintf(2, "pipe: pipe() failed\n"); return -1; }
+  if (!fork()) {
+    close(fd[0]);
+    for (n = mb * 1024 * 1024; n > 0; n -= r)
+      if ((r = write(fd[1], buf, n < bs ? n : bs)) <= 0) exit(-1);
+    exit(0);
+  }
+  close(fd[1]);
+  t = cyc(); total = 0;
+  while ((r = read(fd[0], buf, sizeof(buf))) > 0) total += r;
+  t = cyc() - t;
+  close(fd[0]);
+  wait();
+  printf("%u bytes in %u cycles (%d byte writes), %.2f MB/s\n", total, t, bs, (double)total * CYCUS / t);
+  return 0;
+}
@@ -0,0 +1,102 @@
+// switch -- sparse switch dispatch benchmark
+//
+// Usage:  switch [count]
+//
+// Description:
+//   Dispatches count (default 100000) values through a switch with 200 sparse cases,
+//   hitting each case in turn and missing on every other value.  Reports cycles per
+//   dispatch.  First checks a switch with no default whose jump table is not the last
+//   thing searched, and one with a run of cases up to the largest int, and fails if a
+//   value lands on the wrong case.
+
+#include <u.h>
+#include <libc.h>
+
+enum { CASES = 200 };
+
+int key[CASES*2];
+
+uint cyc() { asm(CYC); }
+
+int sparse(int x)
+{
+  switch (x) {
+  case 0: return 0; case 20: return 1; case 66: return 2; case 138: return 3; case 236: return 4;
+  case 360: return 5; case 510: return 6; case 686: return 7; case 888: return 8; case 1116: return 9;
+  case 1370: return 10; case 1650: return 11; case 1956: return 12; case 2288: return 13; case 2646: return 14;
+  case 3030: return 15; case 3440: return 16; case 3876: return 17; case 4338: return 18; case 4826: return 19;
+  case 5340: return 20; case 5880: return 21; case 6446: return 22; case 7038: return 23; case 7656: return 24;
+  case 8300: return 25; case 8970: return 26; case 9666: return 27; case 10388: return 28; case 11136: return 29;
+  case 11910: return 30; case 12710: return 31; case 13536: return 32; case 14388: return 33; case 15266: return 34;
+  case 16170: return 35; case 17100: return 36; case 18056: return 37; case 19038: return 38; case 20046: return 39;
+  case 21080: return 40; case 22140: return 41; case 23226: return 42; case 24338: return 43; case 25476: return 44;
+  case 26640: return 45; case 27830: return 46; case 29046: return 47; case 30288: return 48; case 31556: return 49;
+  case 32850: return 50; case 34170: return 51; case 35516: return 52; case 36888: return 53; case 38286: return 54;
+  case 39710: return 55; case 41160: return 56; case 42636: return 57; case 44138: return 58; case 45666: return 59;
+  case 47220: return 60; case 48800: return 61; case 50406: return 62; case 52038: return 63; case 53696: return 64;
+  case 55380: return 65; case 57090: return 66; case 58826: return 67; case 60588: return 68; case 62376: return 69;
+  case 64190: return 70; case 66030: return 71; case 67896: return 72; case 69788: return 73; case 71706: return 74;
+  case 73650: return 75; case 75620: return 76; case 77616: return 77; case 79638: return 78; case 81686: return 79;
+  case 83760: return 80; case 85860: return 81; case 87986: return 82; case 90138: return 83; case 92316: return 84;
+  case 94520: return 85; case 96750: return 86; case 99006: return 87; case 101288: return 88; case 103596: return 89;
+  case 105930: return 90; case 108290: return 91; case 110676: return 92; case 113088: return 93; case 115526: return 94;
+  case 117990: return 95; case 120480: return 96; case 122996: return 97; case 125538: return 98; case 128106: return 99;
+  case 130700: return 100; case 133320: return 101; case 135966: return 102; case 138638: return 103; case 141336: return 104;
+  case 144060: return 105; case 146810: return 106; case 149586: return 107; case 152388: return 108; case 155216: return 109;
+  case 158070: return 110; case 160950: return 111; case 163856: return 112; case 166788: return 113; case 169746: return 114;
+  case 172730: return 115; case 175740: return 116; case 178776: return 117; case 181838: return 118; case 184926: return 119;
+  case 188040: return 120; case 191180: return 121; case 194346: return 122; case 197538: return 123; case 200756: return 124;
+  case 204000: return 125; case 207270: return 126; case 210566: return 127; case 213888: return 128; case 217236: return 129;
+  case 220610: return 130; case 224010: return 131; case 227436: return 132; case 230888: return 133; case 234366: return 134;
+  case 237870: return 135; case 241400: return 136; case 244956: return 137; case 248538: return 138; case 252146: return 139;
+  case 255780: return 140; case 259440: return 141; case 263126: return 142; case 266838: return 143; case 270576: return 144;
+  case 274340: return 145; case 278130: return 146; case 281946: return 147; case 285788: return 148; case 289656: return 149;
+  case 293550: return 150; case 297470: return 151; case 301416: return 152; case 305388: return 153; case 309386: return 154;
+  case 313410: return 155; case 317460: return 156; case 321536: return 157; case 325638: return 158; case 329766: return 159;
+  case 333920: return 160; case 338100: return 161; case 342306: return 162; case 346538: return 163; case 350796: return 164;
+  case 355080: return 165; case 359390: return 166; case 363726: return 167; case 368088: return 168; case 372476: return 169;
+  case 376890: return 170; case 381330: return 171; case 385796: return 172; case 390288: return 173; case 394806: return 174;
+  case 399350: return 175; case 403920: return 176; case 408516: return 177; case 413138: return 178; case 417786: return 179;
+  case 422460: return 180; case 427160: return 181; case 431886: return 182; case 436638: return 183; case 441416: return 184;
+  case 446220: return 185; case 451050: return 186; case 455906: return 187; case 460788: return 188; case 465696: return 189;
+  case 470630: return 190; case 475590: return 191; case 480576: return 192; case 485588: return 193; case 490626: return 194;
+  case 495690: return 195; case 500780: return 196; case 505896: return 197; case 511038: return 198; case 516206: return 199;
+  }
+  return -1;
+}
+
+int mixed(int x) // no default, table for -5 .. 6 not the last cluster searched
+{
+  int r = -1;
+  switch (x) {
+  case -3000: r = 1; break; case -2000: r = 2; break; case -1000: r = 3; break; case -500: r = 4; break;
+  case -5: r = 5; break; case -4: r = 6; break; case -3: r = 7; break;
+  case 0: r = 8; break; case 1: r = 9; break; case 2: r = 10; break; case 3: r = 11; break; case 4: r = 12; break;
+  case 6: r = 13; break;
+  }
+  return r;
+}
+
+int top(int x) // a run of cases that ends at the largest int
+{
+  switch (x) { case 2147483645: case 2147483646: case 2147483647: return 3; }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int i, n, s; uint t;
+
+  n = (argc > 1) ? atoi(argv[1]) : 100000;
+  if (n < 1) { dprintf(2, "usage: switch [count]\n"); return -1; }
+  for (i = -3001, s = 0; i <= 7; i++) s += mixed(i); // 13 cases hit, the rest miss
+  if (s != 91 - (3009 - 13) || mixed(0) != 8 || mixed(5) != -1 || mixed(6) != 13 ||
+      top(2147483647) != 3 || top(2147483645) != 3 || top(2147483644)) { dprintf(2, "switch: wrong case\n"); return -1; }
+  for (i = 0; i < CASES; i++) { key[i*2] = i*i*13 + i*7; key[i*2+1] = key[i*2] + 1; }
+
+  t = cyc(); s = 0;
+  for (i = 0; i < n; i++) s += sparse(key[i % (CASES*2)]);
+  t = cyc() - t;
+  printf("%d dispatches in %u cycles, %u cycles each (sum %d)\n", n, t, t / n, s);
+  return 0;
+}
@@ -9,6 +9,7 @@
 
 #include <u.h>
 #include <libc.h>
+#include <mem.h>
 #include <libm.h>
 #include <net.h>
 #include <gl.h>
@@ -0,0 +1,49 @@
+// optest -- check code that c -O rewrites
+//
+// Usage:  c -O optest.c
+//
+// Description:
+//   Runs small functions whose code the peephole and register reuse passes rewrite,
+//   and reports each one that gives a different answer than it would unoptimized.
+//   Exits 0 when all agree.
+
+#include <u.h>
+#include <libc.h>
+
+int errs;
+
+void check(char *name, int got, int want)
+{
+  if (got != want) { printf("%s: got %d, want %d\n", name, got, want); errs++; }
+}
+
+int f(int n) // a jump to the next instruction, itself a jump target
+{
+  int s;
+  s = 0;
+top: goto next;
+next: s = s + n;
+  n = n - 1;
+  if (n) goto top;
+  return s;
+}
+
+int g(int n) // the same with the stored value reloaded after the label
+{
+  int i, s;
+  s = -1; i = 0;
+top: goto body;
+body: s = s + i;
+  i = i + 1;
+  if (i < n) goto top;
+  return s;
+}
+
+int main()
+{
+  check("f(4)", f(4), 10);
+  check("f(10)", f(10), 55);
+  check("g(15)", g(15), 104);
+  if (!errs) printf("optest: ok\n");
+  return errs;
+}